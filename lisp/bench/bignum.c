@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <limits.h>
+#include <time.h>
+#include "include.h"
+
+// factorial and exponentiation throughput across operand sizes, once with
+// karatsuba and once with schoolbook multiplication only, best of REPEATS
+// runs each.
+// build with `make bench` in src and run ./bench-bignum
+
+#define REPEATS 5
+
+static double now( void )  {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static lval *op( char *name, lval *x, lval *y )  {
+  lval *a = lval_sexpr();
+  a = lval_add(a, x);
+  a = lval_add(a, y);
+  return builtin_op(NULL, a, name);
+}
+
+static lval *factorial( long n )  {
+  lval *r = lval_int(1);
+  for ( long i = 2; i <= n; i++ )  { r = op("*", r, lval_int(i)); }
+  return r;
+}
+
+static lval *power_of( long base, long exp )  {
+  return op("**", lval_int(base), lval_int(exp));
+}
+
+static int limbs( lval *v )  {
+  return lval_type(v) == LVAL_BIG ? v->len : 1;
+}
+
+// fn(n) under the given karatsuba threshold, timed into *t
+static lval *timed( lval *(*fn)( long ), long n, int threshold, double *t )  {
+  int saved = lbig_karatsuba;
+  lbig_karatsuba = threshold;
+
+  double start = now();
+  lval *r = fn(n);
+  *t = now() - start;
+
+  lbig_karatsuba = saved;
+  return r;
+}
+
+// each variant is called once untimed to warm the caches and the slabs,
+// then timed REPEATS times, taking the best. which one goes first
+// alternates, so neither always runs on what the other left behind
+static void run( char *what, long n, lval *(*fn)( long ), int *same )  {
+  double t[2] = { 1e30, 1e30 };
+  lval *r[2];
+  int thresholds[2] = { lbig_karatsuba, INT_MAX };
+
+  for ( int i = 0; i < 2; i++ )  {
+    double dt;
+    r[i] = timed(fn, n, thresholds[i], &dt);
+  }
+
+  for ( int k = 0; k < REPEATS; k++ )  {
+    for ( int j = 0; j < 2; j++ )  {
+      int i = (j + k) % 2;
+      double dt;
+      lval_del(timed(fn, n, thresholds[i], &dt));
+      if ( dt < t[i] )  { t[i] = dt; }
+    }
+  }
+
+  lval *d = op("-", lval_copy(r[0]), lval_copy(r[1]));
+  *same &= lval_type(d) == LVAL_INT && lval_to_int(d) == 0;
+
+  printf("%-10s %8ld %8d limbs %10.2f ms %10.2f ms %6.2fx\n",
+    what, n, limbs(r[0]), t[0] * 1e3, t[1] * 1e3, t[1] / t[0]);
+
+  lval_del(d);
+  lval_del(r[0]);
+  lval_del(r[1]);
+}
+
+static lval *three_to( long n )  { return power_of(3, n); }
+
+int main( int argc, char **argv )  {
+  long facts[] = { 100, 1000, 5000, 20000 };
+  long pows[] = { 1000, 10000, 100000, 1000000 };
+  int same = 1;
+
+  printf("%-10s %8s %14s %13s %13s %7s\n",
+    "", "n", "result", "karatsuba", "schoolbook", "speedup");
+
+  for ( size_t i = 0; i < sizeof(facts) / sizeof(long); i++ )  {
+    run("n!", facts[i], factorial, &same);
+  }
+  for ( size_t i = 0; i < sizeof(pows) / sizeof(long); i++ )  {
+    run("3^n", pows[i], three_to, &same);
+  }
+
+  if ( !same )  {
+    printf("karatsuba and schoolbook disagree!\n");
+    return 1;
+  }
+  return 0;
+}
@@ -1,3 +1,5 @@
+#include <stddef.h>
+#include <stdint.h>
 #include "mpc.h"
 
 #define LASSERT(args, cond, fmt, ...) \
@@ -15,55 +17,312 @@ struct lenv;
 
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcode lcode;
 
-enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_FUN,
-        LVAL_SEXPR, LVAL_QEXPR };
+enum { LVAL_ERR, LVAL_NUM, LVAL_INT, LVAL_BIG, LVAL_REF, LVAL_SYM, LVAL_FUN,
+        LVAL_SEXPR, LVAL_QEXPR, LVAL_CELLS };
 
 typedef lval* (*lbuiltin) ( lenv*, lval* );
 
+// allocation kinds tracked by the slab allocator, one per heap type
+enum { LALLOC_ENV = LVAL_CELLS + 1, LALLOC_KINDS };
+
+typedef struct {
+  long live;
+  long peak;
+  long total;
+  long bytes;
+} lalloc_stats;
+
+// collector counters, pauses are in microseconds
+typedef struct {
+  long minor;
+  long major;
+  long freed;
+  double last_pause;
+  double max_pause;
+  double total_pause;
+} lgc_stats;
+
+// an lval* is a 64-bit word rather than always a heap pointer.
+// user space pointers leave the top 16 bits clear, so we steal them:
+//   0000:pppp:pppp:pppp  heap lval
+//   0001:pppp:pppp:pppp  builtin function pointer
+//   0002:pppp:pppp:pppp  interned symbol
+//   0003:iiii:iiii:iiii  48 bit integer, wider ones are boxed on the heap
+//   0004..fff4:...       double, with its bits offset by 2^50
+// immediates are never malloc'd, so copying and deleting them is free
+#define LVAL_TAG_MASK    0xFFFF000000000000ULL
+#define LVAL_PTR_MASK    0x0000FFFFFFFFFFFFULL
+#define LVAL_FUN_TAG     0x0001000000000000ULL
+#define LVAL_SYM_TAG     0x0002000000000000ULL
+#define LVAL_INT_TAG     0x0003000000000000ULL
+#define LVAL_NUM_OFFSET  0x0004000000000000ULL
+#define LVAL_CANON_NAN   0x7FF8000000000000ULL
+
+// cells an expression holds without a separate buffer
+#define LVAL_INLINE 4
+
+// the most arguments an error message can take
+#define LERR_ARGS 4
+
+typedef union {
+  long i;
+  double f;
+  char *s;
+} lerr_arg;
+
+// an entry in the symbol table, see intern.c
+typedef struct lsym lsym;
+struct lsym {
+  lsym *next;
+  uint32_t hash;
+  char name[];
+};
+
+// heap lvals are allocated at the size their type needs, not sizeof(lval).
+// errors keep their text inline straight after the header.
+// they are reference counted and shared: lval_copy only bumps rc, and
+// anything that wants to mutate a value takes a private one via lval_own
 struct lval {
-  int type;
+  unsigned char type;
+  unsigned char gc;
+  int rc;
 
-  double num;
-  char* err;
-  char* sym;
+  union {
+    // LVAL_FUN ( lambdas only, builtins are immediates )
+    // code is the body compiled on the first call, see vm.c
+    struct {
+      lenv *env;
+      lval *formals;
+      lval *body;
+      lcode *code;
+    };
 
-  lbuiltin builtin;
-  lenv *env;
-  lval *formals;
-  lval *body;
+    // LVAL_SEXPR, LVAL_QEXPR
+    // a window of count cells onto a buffer that other expressions may
+    // share, which is what lets tail, init and cons avoid copying.
+    // short expressions keep their cells in small instead and have no buf
+    struct {
+      lval** cell;
+      int count;
+      lval *buf;
+      lval *small[LVAL_INLINE];
+    };
 
-  int count;
-  lval** cell;
-  int none;
+    // LVAL_CELLS, the buffer behind an expression. it owns the elements
+    // in slot[low .. high) and the rest is spare room at either end
+    struct {
+      int cap;
+      int low;
+      int high;
+      lval *slot[0];
+    };
+
+    // LVAL_INT, only those too wide to be immediates
+    long num;
+
+    // LVAL_BIG, integers too wide for a long, see bignum.c
+    struct {
+      int sign;
+      int len;
+      uint32_t limb[0];
+    };
+
+    // LVAL_REF, a variable in a lambda body bound in slot at of the call
+    // frame depth frames out from the lambda's own, see lval_resolve.
+    // a global one has at -1 and remembers the binding it last found in
+    // val, see lenv_ref
+    struct {
+      lval *var;
+      int depth;
+      int at;
+      lval *val;
+      unsigned long ver;
+    };
+
+    // LVAL_ERR, kept unformatted until somebody prints it, see lval_err
+    struct {
+      char *fmt;
+      int argc;
+      lerr_arg argv[LERR_ARGS];
+    };
+  };
 };
 
+// collector flags kept in lval.gc
+#define LGC_MARK   0x01
+#define LGC_SCOPE  0x02
+#define LGC_OLD    0x04
+
+#define LVAL_SIZE_FUN      ( offsetof(lval, code) + sizeof(lcode*) )
+#define LVAL_SIZE_EXPR     ( offsetof(lval, small) + sizeof(lval*) * LVAL_INLINE )
+#define LVAL_SIZE_CELLS(n) ( offsetof(lval, slot) + sizeof(lval*) * (n) )
+#define LVAL_SIZE_INT      ( offsetof(lval, num) + sizeof(long) )
+#define LVAL_SIZE_BIG(n)   ( offsetof(lval, limb) + sizeof(uint32_t) * (n) )
+#define LVAL_SIZE_REF      ( offsetof(lval, ver) + sizeof(unsigned long) )
+#define LVAL_SIZE_ERR      ( offsetof(lval, argv) + sizeof(lerr_arg) * LERR_ARGS )
+
+typedef struct {
+  lval *sym;
+  lval *val;
+} lentry;
+
+// bindings live in ents in the order they were made. once there are more
+// than a handful, index is an open addressing table over them keyed by
+// the symbol's hash, until then a scan of ents is quicker.
+// envs are shared and reference counted like lvals, and start with the
+// same header so the collector can trace them. a lambda holds on to the
+// env it was made in, and each call binds its arguments in a new frame
+// on top of that one. frame is set on those, every other env is global.
+// extra is set on a frame that has had names put in it besides the ones
+// its call bound. arena is set while a frame's ents are slots on the
+// frame stack
 struct lenv {
+  unsigned char type;
+  unsigned char gc;
+  int rc;
+
   lenv *par;
+  int frame;
+  int extra;
+  int arena;
   int count;
-  char **syms;
-  lval **vals;
+  int cap;
+  lentry *ents;
+  int *index;
+  int mask;
 };
 
+static inline int lval_is_imm( lval *v )  {
+  return ((uint64_t)(uintptr_t)v & LVAL_TAG_MASK) != 0;
+}
+
+static inline int lval_is_builtin( lval *v )  {
+  return ((uint64_t)(uintptr_t)v & LVAL_TAG_MASK) == LVAL_FUN_TAG;
+}
+
+static inline int lval_is_sym( lval *v )  {
+  return ((uint64_t)(uintptr_t)v & LVAL_TAG_MASK) == LVAL_SYM_TAG;
+}
+
+static inline lsym *lval_to_sym( lval *v )  {
+  return (lsym*)(uintptr_t)((uint64_t)(uintptr_t)v & LVAL_PTR_MASK);
+}
+
+static inline char *lval_sym_name( lval *v )  {
+  return lval_to_sym(v)->name;
+}
+
+static inline double lval_to_num( lval *v )  {
+  uint64_t bits = (uint64_t)(uintptr_t)v - LVAL_NUM_OFFSET;
+  double x;
+  memcpy(&x, &bits, sizeof(x));
+  return x;
+}
+
+static inline long lval_to_int( lval *v )  {
+  uint64_t bits = (uint64_t)(uintptr_t)v;
+  if ( (bits & LVAL_TAG_MASK) != LVAL_INT_TAG )  { return v->num; }
+
+  // sign extend the 48 bit payload
+  return (long)(bits << 16) >> 16;
+}
+
+static inline lbuiltin lval_to_builtin( lval *v )  {
+  if ( !lval_is_builtin(v) )  { return NULL; }
+  return (lbuiltin)(uintptr_t)((uint64_t)(uintptr_t)v & LVAL_PTR_MASK);
+}
+
+static inline int lval_type( lval *v )  {
+  uint64_t tag = (uint64_t)(uintptr_t)v & LVAL_TAG_MASK;
+
+  if ( tag == 0 )  { return v->type; }
+  if ( tag == LVAL_FUN_TAG )  { return LVAL_FUN; }
+  if ( tag == LVAL_SYM_TAG )  { return LVAL_SYM; }
+  if ( tag == LVAL_INT_TAG )  { return LVAL_INT; }
+  return LVAL_NUM;
+}
+
+static inline int lval_is_num( lval *v )  {
+  int t = lval_type(v);
+  return t == LVAL_NUM || t == LVAL_INT || t == LVAL_BIG;
+}
+
+double lbig_to_double( lval *v );
+
+// any kind of number as a double
+static inline double lval_to_double( lval *v )  {
+  int t = lval_type(v);
+  if ( t == LVAL_INT )  { return lval_to_int(v); }
+  if ( t == LVAL_BIG )  { return lbig_to_double(v); }
+  return lval_to_num(v);
+}
+
+void *lalloc( int kind, size_t size );
+void lfree( int kind, void *p, size_t size );
+void lalloc_move( int from, int to, size_t size );
+lalloc_stats *lalloc_stat( int kind );
+char *lalloc_name( int kind );
+void lalloc_each( int kind, void (*fn)( void* ) );
+int lalloc_is_free( void *p );
+
+extern int lbig_karatsuba;
+lval *lbig_op( char *op, lval *x, lval *y );
+lval *lbig_read( char *s );
+char *lbig_str( lval *v );
+
+void lgc_collect( void );
+void lgc_maybe( void );
+void lgc_track( lval *v );
+void lgc_promote( lval *v );
+void lgc_tune( long nursery, double growth );
+lgc_stats *lgc_stat( void );
+
+extern unsigned long lenv_version;
+
 lenv *lenv_new( void );
 void lenv_del( lenv *e );
+void lenv_free( lenv *e );
+lenv *lenv_enter( lenv *par, int n );
+void lenv_leave( lenv *e, int n );
+void lenv_bind( lenv *e, lval *formals, lval **a, int n );
 lval *lenv_get( lenv *e, lval *k );
+lval *lenv_get_local( lenv *e, lval *k );
+int lenv_slot( lenv *e, lval *k );
+lval *lenv_ref( lenv *e, lval *r );
 void lenv_put( lenv *e, lval *k, lval *v );
 void lenv_def( lenv *e, lval *k, lval *v );
 lenv *lenv_copy( lenv *e );
 void lenv_add_builtin( lenv *e, char *name, lbuiltin func );
 void lenv_add_builtins( lenv *e );
+int lenv_builtin_count( void );
+lbuiltin lenv_builtin( int id );
+int lenv_builtin_id( lbuiltin func );
+
+lval *lmod_get( lenv *e, lval *k );
+
+lval *limage_save( lenv *e, char *name );
+lval *limage_load( char *path, lenv **out );
 
 lval* lval_num( double x );
+lval* lval_int( long x );
+lval* lval_big( int sign, int len );
 lval* lval_err( char *fmt, ... );
+void lval_err_format( lval *v, char *buf, size_t size );
 lval* lval_sym( char *s );
 lval* lval_sexpr( void );
 lval* lval_qexpr( void );
 lval* lval_fun( lbuiltin func );
-lval *lval_lambda( lval *formals, lval *body );
+lval *lval_lambda( lenv *e, lval *formals, lval *body );
+lval *lval_closure( lenv *e, lval *formals, lval *body );
+lval *lval_ref( lval *var, int depth, int at );
 char *ltype_name( int t );
 lval *lval_copy( lval *v );
-lval *lval_call( lenv *e, lval *f, lval *a );
+lval *lval_own( lval *v );
+lval *lval_partial( lval *f, lval *a );
+lenv *lval_bind( lval *f, lval **a, int n );
+lval *lval_formals_dup( lval *formals );
 
 void lval_del( lval *v );
 
@@ -72,17 +331,30 @@ lval *lval_pop( lval* v, int i );
 lval *lval_push( lval* v, lval *x );
 lval *lval_take( lval *v, int i );
 lval *lval_join( lval *x, lval *y );
+lval *lval_tail( lval *v );
+lval *lval_init( lval *v );
+lval *lval_cons( lval *x, lval *v );
+lval *lval_unquote( lval *q );
 
 lval *lval_eval_sexpr( lenv *e, lval* v );
+lval *lval_callee( lval *v, lval **result );
 lval *lval_eval( lenv *e, lval *v );
 
+lcode *lcode_compile( lval *body );
+lcode *lcode_copy( lcode *c );
+void lcode_del( lcode *c );
+lval *lcode_eval( lenv *e, lval *v );
+void lcode_tune( long limit );
+
 lval *builtin_op( lenv *e, lval *a, char *op );
 lval *builtin( lval *a, char *func );
 
 lval *lval_read_num( mpc_ast_t *t );
 lval *lval_read( mpc_ast_t* t );
+lval *lval_read_file( char *path );
+mpc_parser_t *lval_grammar( void );
+void lval_grammar_cleanup( void );
 
-void lval_expr_print( lval *v, char open, char close );
 void lval_print( lval *v );
 void lval_println( lval *v );
 
@@ -117,6 +389,12 @@ lval *builtin_def( lenv *e, lval *a );
 lval *builtin_env( lenv *e, lval *a );
 lval *builtin_lambda( lenv *e, lval *a );
 lval *builtin_put( lenv *e, lval *a );
+lval *builtin_mem( lenv *e, lval *a );
+lval *builtin_gc( lenv *e, lval *a );
+lval *builtin_gc_tune( lenv *e, lval *a );
+lval *builtin_save_image( lenv *e, lval *a );
+lval *builtin_export( lenv *e, lval *a );
+lval *builtin_max_depth( lenv *e, lval *a );
 lval *builtin_var( lenv *e, lval *a, char *func );
 
 double power( double base, long exp );
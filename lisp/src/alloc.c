@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include "include.h"
+
+// lval and lenv nodes are carved out of 64k slabs and recycled through a
+// free list per size class instead of going to malloc every time.
+// caches and counters are thread local, so nothing here needs a lock.
+// every kind gets its own slabs so the collector can walk them, except
+// that s and q expressions turn into one another in place and share
+// theirs, or a loop doing that would drain one free list into the other
+#define LALLOC_SLAB   ( 64 * 1024 )
+#define LALLOC_MAX    256
+
+// first word of a slot sitting on a free list, never a live header
+#define LALLOC_FREE   ( ~(uintptr_t)0 )
+
+typedef struct lslot lslot;
+struct lslot {
+  uintptr_t mark;
+  lslot *next;
+};
+
+typedef struct lslab lslab;
+struct lslab {
+  lslab *next;
+  char *top;
+  char *end;
+  char data[];
+};
+
+typedef struct {
+  lslot *free;
+  lslab *slabs;
+} lcache;
+
+static const size_t lalloc_sizes[] = { 16, 24, 32, 48, 64, 96, 128, 192, 256 };
+
+#define LALLOC_CLASSES  ( sizeof(lalloc_sizes) / sizeof(lalloc_sizes[0]) )
+
+// size class for every multiple of 8 up to LALLOC_MAX
+static const unsigned char lalloc_class_of[] = {
+  0, 0, 0, 1, 2, 3, 3, 4, 4,
+  5, 5, 5, 5, 6, 6, 6, 6,
+  7, 7, 7, 7, 7, 7, 7, 7,
+  8, 8, 8, 8, 8, 8, 8, 8
+};
+
+static __thread lcache lalloc_caches[LALLOC_KINDS][LALLOC_CLASSES];
+static __thread lalloc_stats lalloc_counts[LALLOC_KINDS];
+
+static lcache *lalloc_cache( int kind, size_t size )  {
+  if ( kind == LVAL_QEXPR )  { kind = LVAL_SEXPR; }
+  return &lalloc_caches[kind][lalloc_class_of[(size + 7) >> 3]];
+}
+
+static size_t lalloc_rounded( size_t size )  {
+  if ( size > LALLOC_MAX )  { return size; }
+  return lalloc_sizes[lalloc_class_of[(size + 7) >> 3]];
+}
+
+void *lalloc( int kind, size_t size )  {
+  void *p;
+
+  if ( unlikely(size > LALLOC_MAX) )  {
+    p = malloc(size);
+  } else {
+    lcache *c = lalloc_cache(kind, size);
+    size = lalloc_rounded(size);
+
+    if ( c->free )  {
+      p = c->free;
+      c->free = c->free->next;
+    } else {
+      lslab *s = c->slabs;
+      if ( unlikely(!s || s->top + size > s->end) )  {
+        // whatever is left of the old slab is too small to use
+        s = malloc(LALLOC_SLAB);
+        s->next = c->slabs;
+        s->top = s->data;
+        s->end = (char*)s + LALLOC_SLAB;
+        c->slabs = s;
+      }
+      p = s->top;
+      s->top += size;
+    }
+  }
+
+  lalloc_stats *s = &lalloc_counts[kind];
+  s->live++;
+  s->total++;
+  s->bytes += size;
+  if ( s->live > s->peak )  { s->peak = s->live; }
+
+  return p;
+}
+
+void lfree( int kind, void *p, size_t size )  {
+  lalloc_stats *s = &lalloc_counts[kind];
+  s->live--;
+  s->bytes -= lalloc_rounded(size);
+
+  if ( unlikely(size > LALLOC_MAX) )  {
+    free(p);
+    return;
+  }
+
+  lcache *c = lalloc_cache(kind, size);
+  lslot *slot = p;
+  slot->mark = LALLOC_FREE;
+  slot->next = c->free;
+  c->free = slot;
+}
+
+// a node changed type in place, move it over in the counters
+void lalloc_move( int from, int to, size_t size )  {
+  size = lalloc_rounded(size);
+
+  lalloc_counts[from].live--;
+  lalloc_counts[from].bytes -= size;
+
+  lalloc_stats *s = &lalloc_counts[to];
+  s->live++;
+  s->bytes += size;
+  if ( s->live > s->peak )  { s->peak = s->live; }
+}
+
+int lalloc_is_free( void *p )  {
+  return *(uintptr_t*)p == LALLOC_FREE;
+}
+
+// call fn on every live node of a kind. only sees slab allocations, which
+// is everything the collector traces since containers are never that big
+void lalloc_each( int kind, void (*fn)( void* ) )  {
+  for ( size_t i = 0; i < LALLOC_CLASSES; i++ )  {
+    size_t size = lalloc_sizes[i];
+
+    for ( lslab *s = lalloc_cache(kind, size)->slabs; s; s = s->next )  {
+      for ( char *p = s->data; p + size <= s->top; p += size )  {
+        // a free slot never starts with a kind, and a shared slab holds
+        // other kinds than this one
+        if ( *(unsigned char*)p == kind )  { fn(p); }
+      }
+    }
+  }
+}
+
+lalloc_stats *lalloc_stat( int kind )  {
+  return &lalloc_counts[kind];
+}
+
+char *lalloc_name( int kind )  {
+  if ( kind == LALLOC_ENV )  { return "Environment"; }
+  return ltype_name(kind);
+}
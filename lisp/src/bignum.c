@@ -0,0 +1,585 @@
+#include <stdio.h>
+#include <limits.h>
+#include <math.h>
+#include "include.h"
+
+// integers too big for a long. the magnitude is stored in 32 bit limbs,
+// least significant first, with no leading zero limbs. every result is
+// normalised, so anything that fits in a long comes back as an LVAL_INT
+// and a bignum is never zero
+
+// operand length, in limbs, above which multiplication goes karatsuba
+int lbig_karatsuba = 32;
+
+// the most limbs a result may have, 32M bits. a step whose answer would
+// be longer is an error, found before anything is allocated for it, so
+// (** 2 4000000000) can't ask for gigabytes
+#define LBIG_MAX_LEN  ( 1 << 20 )
+
+static lval *lbig_too_big( void )  {
+  return lval_err("Integer result longer than %d bits!", LBIG_MAX_LEN * 32);
+}
+
+// either kind of integer seen as sign and magnitude
+typedef struct {
+  int sign;
+  int len;
+  uint32_t *limb;
+  uint32_t small[2];
+} lbig;
+
+static void lbig_view( lbig *b, lval *v )  {
+  if ( lval_type(v) == LVAL_BIG )  {
+    b->sign = v->sign;
+    b->len = v->len;
+    b->limb = v->limb;
+    return;
+  }
+
+  long n = lval_to_int(v);
+  unsigned long m = n < 0 ? -(unsigned long)n : (unsigned long)n;
+
+  b->sign = n < 0 ? -1 : 1;
+  b->small[0] = m;
+  b->small[1] = m >> 32;
+  b->limb = b->small;
+  b->len = b->small[1] ? 2 : ( b->small[0] ? 1 : 0 );
+}
+
+// copy a magnitude into a new value, or an LVAL_INT if it fits
+static lval *lbig_make( int sign, uint32_t *limb, int len )  {
+  while ( len && limb[len - 1] == 0 )  { len--; }
+
+  if ( len <= 2 )  {
+    unsigned long m = len ? limb[0] : 0;
+    if ( len == 2 )  { m |= (unsigned long)limb[1] << 32; }
+
+    if ( m <= LONG_MAX )  { return lval_int(sign < 0 ? -(long)m : (long)m); }
+    if ( sign < 0 && m == (unsigned long)LONG_MAX + 1 )  { return lval_int(LONG_MIN); }
+  }
+
+  lval *v = lval_big(sign, len);
+  memcpy(v->limb, limb, sizeof(uint32_t) * len);
+  return v;
+}
+
+//
+// MAGNITUDES
+//
+
+static int lbig_cmp_mag( uint32_t *a, int an, uint32_t *b, int bn )  {
+  if ( an != bn )  { return an < bn ? -1 : 1; }
+  for ( int i = an - 1; i >= 0; i-- )  {
+    if ( a[i] != b[i] )  { return a[i] < b[i] ? -1 : 1; }
+  }
+  return 0;
+}
+
+static int lbig_cmp( lbig *a, lbig *b )  {
+  int sa = a->len ? a->sign : 0;
+  int sb = b->len ? b->sign : 0;
+  if ( sa != sb )  { return sa < sb ? -1 : 1; }
+  return sa * lbig_cmp_mag(a->limb, a->len, b->limb, b->len);
+}
+
+// r = a + b, r has room for max(an, bn) + 1 limbs
+static int lbig_add_mag( uint32_t *r, uint32_t *a, int an, uint32_t *b, int bn )  {
+  if ( an < bn )  { return lbig_add_mag(r, b, bn, a, an); }
+
+  uint64_t carry = 0;
+  for ( int i = 0; i < an; i++ )  {
+    carry += (uint64_t)a[i] + (i < bn ? b[i] : 0);
+    r[i] = carry;
+    carry >>= 32;
+  }
+  r[an] = carry;
+  return an + 1;
+}
+
+// r = a - b where a >= b, r has room for an limbs
+static int lbig_sub_mag( uint32_t *r, uint32_t *a, int an, uint32_t *b, int bn )  {
+  int64_t borrow = 0;
+  for ( int i = 0; i < an; i++ )  {
+    int64_t d = (int64_t)a[i] - (i < bn ? b[i] : 0) - borrow;
+    borrow = d < 0;
+    r[i] = d + (borrow << 32);
+  }
+  return an;
+}
+
+// r[off ..] += t, the true sum has to fit in rn limbs
+static void lbig_add_at( uint32_t *r, int rn, uint32_t *t, int tn, int off )  {
+  uint64_t carry = 0;
+  for ( int i = 0; off + i < rn && (i < tn || carry); i++ )  {
+    carry += (uint64_t)r[off + i] + (i < tn ? t[i] : 0);
+    r[off + i] = carry;
+    carry >>= 32;
+  }
+}
+
+// r -= t in place, r >= t
+static void lbig_sub_from( uint32_t *r, int rn, uint32_t *t, int tn )  {
+  int64_t borrow = 0;
+  for ( int i = 0; i < rn && (i < tn || borrow); i++ )  {
+    int64_t d = (int64_t)r[i] - (i < tn ? t[i] : 0) - borrow;
+    borrow = d < 0;
+    r[i] = d + (borrow << 32);
+  }
+}
+
+// r = a * b, r has exactly an + bn limbs
+static void lbig_mul_mag( uint32_t *r, uint32_t *a, int an, uint32_t *b, int bn )  {
+  if ( an < bn )  { lbig_mul_mag(r, b, bn, a, an); return; }
+  memset(r, 0, sizeof(uint32_t) * (an + bn));
+
+  // schoolbook. below four limbs a split would not shrink the operands
+  if ( bn < lbig_karatsuba || bn < 4 )  {
+    for ( int i = 0; i < bn; i++ )  {
+      uint64_t carry = 0;
+      for ( int j = 0; j < an; j++ )  {
+        carry += (uint64_t)b[i] * a[j] + r[i + j];
+        r[i + j] = carry;
+        carry >>= 32;
+      }
+      r[i + an] = carry;
+    }
+    return;
+  }
+
+  int m = an / 2;
+
+  // b is too short to split, so only a gets split
+  if ( bn <= m )  {
+    uint32_t *t = malloc(sizeof(uint32_t) * (an - m + bn));
+    lbig_mul_mag(r, a, m, b, bn);
+    lbig_mul_mag(t, a + m, an - m, b, bn);
+    lbig_add_at(r, an + bn, t, an - m + bn, m);
+    free(t);
+    return;
+  }
+
+  // a = a1 B^m + a0, b = b1 B^m + b0
+  // ab = z2 B^2m + ( (a0 + a1)(b0 + b1) - z2 - z0 ) B^m + z0
+  int n1 = an - m;
+  int n2 = bn - m;
+  lbig_mul_mag(r, a, m, b, m);
+  lbig_mul_mag(r + 2 * m, a + m, n1, b + m, n2);
+
+  uint32_t *sa = malloc(sizeof(uint32_t) * (n1 + 1));
+  uint32_t *sb = malloc(sizeof(uint32_t) * (n1 + 1));
+  int sal = lbig_add_mag(sa, a, m, a + m, n1);
+  int sbl = lbig_add_mag(sb, b, m, b + m, n2);
+  while ( sal > 1 && sa[sal - 1] == 0 )  { sal--; }
+  while ( sbl > 1 && sb[sbl - 1] == 0 )  { sbl--; }
+
+  uint32_t *z1 = malloc(sizeof(uint32_t) * (sal + sbl));
+  lbig_mul_mag(z1, sa, sal, sb, sbl);
+  lbig_sub_from(z1, sal + sbl, r, 2 * m);
+  lbig_sub_from(z1, sal + sbl, r + 2 * m, n1 + n2);
+  lbig_add_at(r, an + bn, z1, sal + sbl, m);
+
+  free(sa);
+  free(sb);
+  free(z1);
+}
+
+// knuth's algorithm d. q gets un - vn + 1 limbs and rem gets vn,
+// un >= vn and v has no leading zero limb
+static void lbig_divmod_mag( uint32_t *q, uint32_t *rem,
+  uint32_t *u, int un, uint32_t *v, int vn )  {
+
+  if ( vn == 1 )  {
+    uint64_t k = 0;
+    for ( int j = un - 1; j >= 0; j-- )  {
+      k = (k << 32) | u[j];
+      q[j] = k / v[0];
+      k %= v[0];
+    }
+    rem[0] = k;
+    return;
+  }
+
+  // normalise so the top limb of v has its high bit set
+  int s = __builtin_clz(v[vn - 1]);
+  uint32_t *vs = malloc(sizeof(uint32_t) * vn);
+  uint32_t *us = malloc(sizeof(uint32_t) * (un + 1));
+
+  for ( int i = vn - 1; i > 0; i-- )  {
+    vs[i] = (v[i] << s) | (uint32_t)((uint64_t)v[i - 1] >> (32 - s));
+  }
+  vs[0] = v[0] << s;
+
+  us[un] = (uint64_t)u[un - 1] >> (32 - s);
+  for ( int i = un - 1; i > 0; i-- )  {
+    us[i] = (u[i] << s) | (uint32_t)((uint64_t)u[i - 1] >> (32 - s));
+  }
+  us[0] = u[0] << s;
+
+  for ( int j = un - vn; j >= 0; j-- )  {
+    uint64_t num = ((uint64_t)us[j + vn] << 32) | us[j + vn - 1];
+    uint64_t qhat = num / vs[vn - 1];
+    uint64_t rhat = num % vs[vn - 1];
+
+    while ( qhat >> 32 || qhat * vs[vn - 2] > ((rhat << 32) | us[j + vn - 2]) )  {
+      qhat--;
+      rhat += vs[vn - 1];
+      if ( rhat >> 32 )  { break; }
+    }
+
+    // multiply and subtract
+    int64_t borrow = 0;
+    int64_t t;
+    for ( int i = 0; i < vn; i++ )  {
+      uint64_t p = qhat * vs[i];
+      t = (int64_t)us[i + j] - borrow - (int64_t)(p & 0xFFFFFFFF);
+      us[i + j] = t;
+      borrow = (int64_t)(p >> 32) - (t >> 32);
+    }
+    t = (int64_t)us[j + vn] - borrow;
+    us[j + vn] = t;
+
+    q[j] = qhat;
+
+    // took one too many, add it back
+    if ( t < 0 )  {
+      q[j]--;
+      uint64_t carry = 0;
+      for ( int i = 0; i < vn; i++ )  {
+        carry += (uint64_t)us[i + j] + vs[i];
+        us[i + j] = carry;
+        carry >>= 32;
+      }
+      us[j + vn] += carry;
+    }
+  }
+
+  for ( int i = 0; i < vn; i++ )  {
+    rem[i] = (us[i] >> s) | (uint32_t)((uint64_t)us[i + 1] << (32 - s));
+  }
+
+  free(vs);
+  free(us);
+}
+
+//
+// ARITHMETIC
+//
+
+static lval *lbig_add( lbig *a, lbig *b, int bsign )  {
+  int n = (a->len > b->len ? a->len : b->len) + 1;
+  uint32_t *r = malloc(sizeof(uint32_t) * n);
+  int sign = a->sign;
+
+  if ( a->sign == bsign )  {
+    n = lbig_add_mag(r, a->limb, a->len, b->limb, b->len);
+  } else if ( lbig_cmp_mag(a->limb, a->len, b->limb, b->len) >= 0 )  {
+    n = lbig_sub_mag(r, a->limb, a->len, b->limb, b->len);
+  } else {
+    n = lbig_sub_mag(r, b->limb, b->len, a->limb, a->len);
+    sign = bsign;
+  }
+
+  lval *v = lbig_make(sign, r, n);
+  free(r);
+  return v;
+}
+
+static lval *lbig_mul( lbig *a, lbig *b )  {
+  if ( !a->len || !b->len )  { return lval_int(0); }
+  if ( a->len + b->len > LBIG_MAX_LEN + 1 )  { return lbig_too_big(); }
+
+  uint32_t *r = malloc(sizeof(uint32_t) * (a->len + b->len));
+  lbig_mul_mag(r, a->limb, a->len, b->limb, b->len);
+
+  lval *v = lbig_make(a->sign * b->sign, r, a->len + b->len);
+  free(r);
+  return v;
+}
+
+// truncating division like c's, so the remainder takes a's sign.
+// returns the quotient for '/' and the remainder for '%'
+static lval *lbig_div( lbig *a, lbig *b, int want_rem, int *exact )  {
+  if ( lbig_cmp_mag(a->limb, a->len, b->limb, b->len) < 0 )  {
+    *exact = a->len == 0;
+    return want_rem ? lbig_make(a->sign, a->limb, a->len) : lval_int(0);
+  }
+
+  uint32_t *q = malloc(sizeof(uint32_t) * (a->len - b->len + 1));
+  uint32_t *r = malloc(sizeof(uint32_t) * b->len);
+  lbig_divmod_mag(q, r, a->limb, a->len, b->limb, b->len);
+
+  int rn = b->len;
+  while ( rn && r[rn - 1] == 0 )  { rn--; }
+  *exact = rn == 0;
+
+  lval *v = want_rem
+    ? lbig_make(a->sign, r, rn)
+    : lbig_make(a->sign * b->sign, q, a->len - b->len + 1);
+
+  free(q);
+  free(r);
+  return v;
+}
+
+// square and multiply. the answer has about y * log2 |x| bits, which is
+// checked against the limit first: squaring up to it would take minutes
+// before a multiplication found it out. 0 and 1 never grow
+static lval *lbig_pow( lbig *x, lval *xv, long y )  {
+  if ( x->len == 0 )  { return lval_int(y == 0); }
+  if ( x->len == 1 && x->limb[0] == 1 )  {
+    return lval_int(x->sign < 0 && (y & 1) ? -1 : 1);
+  }
+
+  double bits = log2(x->limb[x->len - 1]) + 32.0 * (x->len - 1);
+  if ( bits * y > LBIG_MAX_LEN * 32.0 )  { return lbig_too_big(); }
+
+  lval *r = lval_int(1);
+  lval *base = lval_copy(xv);
+  lbig a, b;
+
+  for ( ; y; y >>= 1 )  {
+    lbig_view(&b, base);
+    if ( y & 1 )  {
+      lbig_view(&a, r);
+      lval *t = lbig_mul(&a, &b);
+      lval_del(r);
+      r = t;
+      if ( lval_type(r) == LVAL_ERR )  { break; }
+    }
+    if ( y > 1 )  {
+      lval *t = lbig_mul(&b, &b);
+      lval_del(base);
+      base = t;
+      if ( lval_type(base) == LVAL_ERR )  {
+        lval_del(r);
+        return base;
+      }
+    }
+  }
+
+  lval_del(base);
+  return r;
+}
+
+static lval *lbig_shift( lbig *a, long y, int left )  {
+  if ( left )  {
+    if ( a->len + y / 32 > LBIG_MAX_LEN )  { return lbig_too_big(); }
+    int words = y / 32, bits = y % 32;
+    int n = a->len + words + 1;
+    uint32_t *r = calloc(n, sizeof(uint32_t));
+
+    for ( int i = 0; i < a->len; i++ )  {
+      uint64_t w = (uint64_t)a->limb[i] << bits;
+      r[i + words] |= w;
+      r[i + words + 1] |= w >> 32;
+    }
+
+    lval *v = lbig_make(a->sign, r, n);
+    free(r);
+    return v;
+  }
+
+  int words = y / 32, bits = y % 32;
+  if ( words >= a->len )  { return lval_int(a->sign < 0 ? -1 : 0); }
+
+  int n = a->len - words;
+  uint32_t *r = malloc(sizeof(uint32_t) * (n + 1));
+  int lost = 0;
+
+  for ( int i = 0; i < words; i++ )  { lost |= a->limb[i] != 0; }
+  lost |= bits && (a->limb[words] << (32 - bits)) != 0;
+
+  for ( int i = 0; i < n; i++ )  {
+    uint64_t w = a->limb[i + words];
+    if ( i + words + 1 < a->len )  { w |= (uint64_t)a->limb[i + words + 1] << 32; }
+    r[i] = w >> bits;
+  }
+  r[n] = 0;
+
+  // shifts floor, so a negative number that lost bits rounds away from 0
+  if ( a->sign < 0 && lost )  {
+    uint32_t one = 1;
+    lbig_add_at(r, n + 1, &one, 1, 0);
+    n++;
+  }
+
+  lval *v = lbig_make(a->sign, r, n);
+  free(r);
+  return v;
+}
+
+// two's complement of a, sign extended to n limbs
+static void lbig_twos( uint32_t *r, lbig *a, int n )  {
+  memset(r, 0, sizeof(uint32_t) * n);
+  memcpy(r, a->limb, sizeof(uint32_t) * a->len);
+  if ( a->sign > 0 )  { return; }
+
+  uint64_t carry = 1;
+  for ( int i = 0; i < n; i++ )  {
+    carry += (uint32_t)~r[i];
+    r[i] = carry;
+    carry >>= 32;
+  }
+}
+
+static lval *lbig_bitwise( char op, lbig *a, lbig *b )  {
+  int n = (a->len > b->len ? a->len : b->len) + 1;
+  uint32_t *x = malloc(sizeof(uint32_t) * n);
+  uint32_t *y = malloc(sizeof(uint32_t) * n);
+  lbig_twos(x, a, n);
+  lbig_twos(y, b, n);
+
+  for ( int i = 0; i < n; i++ )  {
+    if ( op == '&' )  { x[i] &= y[i]; }
+    if ( op == '|' )  { x[i] |= y[i]; }
+    if ( op == '^' )  { x[i] ^= y[i]; }
+  }
+
+  // a set top bit means negative, take the magnitude back out
+  int sign = x[n - 1] >> 31 ? -1 : 1;
+  if ( sign < 0 )  {
+    lbig r = { .sign = -1, .len = n, .limb = x };
+    lbig_twos(y, &r, n);
+  } else {
+    memcpy(y, x, sizeof(uint32_t) * n);
+  }
+
+  lval *v = lbig_make(sign, y, n);
+  free(x);
+  free(y);
+  return v;
+}
+
+// one step of an exact integer fold, for when the operands or the answer
+// don't fit a long. x and y are LVAL_INT or LVAL_BIG and are left alone.
+// returns NULL when there is no exact integer answer, and an error when
+// the answer is longer than LBIG_MAX_LEN limbs
+lval *lbig_op( char *op, lval *x, lval *y )  {
+  lbig a, b;
+  lbig_view(&a, x);
+  lbig_view(&b, y);
+
+  if ( strcmp(op, "+") == 0 )  { return lbig_add(&a, &b, b.sign); }
+  if ( strcmp(op, "-") == 0 )  { return lbig_add(&a, &b, -b.sign); }
+  if ( strcmp(op, "*") == 0 )  { return lbig_mul(&a, &b); }
+
+  if ( strcmp(op, "/") == 0 || strcmp(op, "%") == 0 )  {
+    if ( !b.len )  { return NULL; }
+
+    int exact;
+    lval *v = lbig_div(&a, &b, op[0] == '%', &exact);
+    if ( op[0] == '/' && !exact )  {
+      lval_del(v);
+      return NULL;
+    }
+    return v;
+  }
+
+  int cmp = lbig_cmp(&a, &b);
+
+  if ( strcmp(op, "&") == 0 || strcmp(op, "|") == 0 || strcmp(op, "^") == 0 )  {
+    return lbig_bitwise(op[0], &a, &b);
+  }
+
+  if ( strcmp(op, "max") == 0 )  { return lval_copy(cmp >= 0 ? x : y); }
+  if ( strcmp(op, "min") == 0 )  { return lval_copy(cmp <= 0 ? x : y); }
+
+  // the rest take a non negative right hand side. one too big for a long
+  // leaves nothing to compute: only 0 and 1 survive it, whatever else is
+  // shifted or raised by it is too long, and a shift right loses it all
+  if ( b.sign < 0 )  { return NULL; }
+  if ( lval_type(y) == LVAL_BIG )  {
+    int one = a.len == 1 && a.limb[0] == 1;
+    if ( strcmp(op, "**") == 0 )  {
+      if ( !a.len )  { return lval_int(0); }
+      if ( one )  { return lval_int(a.sign < 0 && (b.limb[0] & 1) ? -1 : 1); }
+      return lbig_too_big();
+    }
+    if ( strcmp(op, "<<") == 0 )  { return a.len ? lbig_too_big() : lval_int(0); }
+    if ( strcmp(op, ">>") == 0 )  { return lval_int(a.sign < 0 && a.len ? -1 : 0); }
+    return NULL;
+  }
+  long n = lval_to_int(y);
+
+  if ( strcmp(op, "**") == 0 )  { return lbig_pow(&a, x, n); }
+  if ( strcmp(op, "<<") == 0 )  {
+    if ( !a.len )  { return lval_int(0); }
+    return lbig_shift(&a, n, 1);
+  }
+  if ( strcmp(op, ">>") == 0 )  {
+    if ( !a.len )  { return lval_int(0); }
+    return lbig_shift(&a, n > INT_MAX ? INT_MAX : n, 0);
+  }
+
+  return NULL;
+}
+
+double lbig_to_double( lval *v )  {
+  double x = 0;
+  for ( int i = v->len - 1; i >= 0; i-- )  {
+    x = x * 4294967296.0 + v->limb[i];
+  }
+  return v->sign * x;
+}
+
+// read a string of decimal digits, nine at a time
+lval *lbig_read( char *s )  {
+  size_t digits = strlen(s);
+  int cap = digits / 9 + 2;
+  uint32_t *r = calloc(cap, sizeof(uint32_t));
+  int n = 0;
+
+  while ( *s )  {
+    uint32_t chunk = 0, scale = 1;
+    for ( int i = 0; i < 9 && *s; i++, s++ )  {
+      chunk = chunk * 10 + (*s - '0');
+      scale *= 10;
+    }
+
+    uint64_t carry = chunk;
+    for ( int i = 0; i < n; i++ )  {
+      carry += (uint64_t)r[i] * scale;
+      r[i] = carry;
+      carry >>= 32;
+    }
+    if ( carry )  { r[n++] = carry; }
+  }
+
+  lval *v = lbig_make(1, r, n);
+  free(r);
+  return v;
+}
+
+// decimal digits, peeled off nine at a time. the caller frees the string
+char *lbig_str( lval *v )  {
+  int n = v->len;
+  uint32_t *t = malloc(sizeof(uint32_t) * n);
+  memcpy(t, v->limb, sizeof(uint32_t) * n);
+
+  // 9.64 decimal digits per limb, plus the sign and the terminator
+  size_t cap = n * 10 + 2;
+  char *s = malloc(cap);
+  char *p = s + cap - 1;
+  *p = '\0';
+
+  while ( n )  {
+    uint64_t k = 0;
+    for ( int i = n - 1; i >= 0; i-- )  {
+      k = (k << 32) | t[i];
+      t[i] = k / 1000000000;
+      k %= 1000000000;
+    }
+    while ( n && t[n - 1] == 0 )  { n--; }
+
+    for ( int i = 0; i < 9 && (n || k); i++ )  {
+      *--p = '0' + k % 10;
+      k /= 10;
+    }
+  }
+
+  if ( v->sign < 0 )  { *--p = '-'; }
+  memmove(s, p, strlen(p) + 1);
+
+  free(t);
+  return s;
+}
@@ -72,17 +72,18 @@ lval *builtin_head( lenv *e, lval *a ) {
     "Function 'head' passed too many arguments!\n"
     "\tRecieved %d, expected %d", a->count, 1);
 
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR,
     "Function 'head' passed incorrect type!\n"
     "\tRecieved %s, expected %s",
-    ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+    ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
 
   LASSERT(a, a->cell[0]->count != 0,
     "Function 'head' passed {}!");
 
   lval *v = lval_take(a, 0);
-  while ( v->count > 1 )  { lval_del(lval_pop(v, 1)); }
-  return v;
+  lval *q = lval_add(lval_qexpr(), lval_copy(v->cell[0]));
+  lval_del(v);
+  return q;
 }
 
 lval *builtin_tail( lenv *e, lval *a ) {
@@ -90,20 +91,19 @@ lval *builtin_tail( lenv *e, lval *a ) {
     "Function 'tail' passed too many arguments!\n"
     "\tRecieved %d, expected %d", a->count, 1);
 
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR,
     "Function 'tail' passed incorrect type!\n"
     "\tRecieved %s, expected %s",
-    ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+    ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
 
   LASSERT(a, a->cell[0]->count != 0,
     "Function 'tail' passed {}! ");
 
-  lval *v = lval_take(a, 0);
-  lval_del(lval_pop(v, 0));
-  return v;
+  return lval_tail(lval_take(a, 0));
 }
 
 lval *builtin_list( lenv *e, lval *a )  {
+  lalloc_move(LVAL_SEXPR, LVAL_QEXPR, LVAL_SIZE_EXPR);
   a->type = LVAL_QEXPR;
   return a;
 }
@@ -113,23 +113,21 @@ lval *builtin_eval( lenv *e, lval *a ) {
     "Function 'eval' passed too many arguments!\n"
     "\tRecieved %d, expected %d", a->count, 1);
 
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR,
     "Function 'eval' passed incorrect type!\n"
     "\tRecieved %s, expected %s",
-    ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+    ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
 
-  lval *x = lval_take(a, 0);
-  x->type = LVAL_SEXPR;
-  return lval_eval(e, x);
+  return lval_eval(e, lval_unquote(lval_take(a, 0)));
 }
 
 lval *builtin_join( lenv *e, lval *a )  {
 
   for ( size_t i = 0; i < a->count; i++ )  {
-    LASSERT(a, a->cell[i]->type == LVAL_QEXPR,
+    LASSERT(a, lval_type(a->cell[i]) == LVAL_QEXPR,
       "Function 'join' passed incorrect type!\n"
       "\tRecieved %s, expected %s",
-      ltype_name(a->cell[i]->type), ltype_name(LVAL_QEXPR));
+      ltype_name(lval_type(a->cell[i])), ltype_name(LVAL_QEXPR));
   }
 
   lval *x = lval_pop(a, 0);
@@ -147,23 +145,15 @@ lval *builtin_init( lenv *e, lval *a )  {
     "Function 'init' passed too many arguments!\n"
     "\tRecieved %d, expected %d", a->count, 1);
 
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR,
     "Function 'init' passed incorrect type!\n"
     "\tRecieved %s, expected %s",
-    ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+    ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
 
   LASSERT(a, a->cell[0]->count != 0,
     "Function 'init' passed {}! ");
 
-  lval *x = lval_take(a, 0);
-  lval *q = lval_qexpr();
-
-  while (x->count > 1)  {
-    q = lval_add(q, lval_pop(x, 0));
-  }
-
-  lval_del(x);
-  return q;
+  return lval_init(lval_take(a, 0));
 }
 
 lval *builtin_cons( lenv *e, lval *a )  {
@@ -171,17 +161,16 @@ lval *builtin_cons( lenv *e, lval *a )  {
     "Function 'cons' passed too many arguments!\n"
     "\tRecieved %d, expected %d", a->count, 2);
 
-  LASSERT(a, a->cell[1]->type == LVAL_QEXPR,
+  LASSERT(a, lval_type(a->cell[1]) == LVAL_QEXPR,
     "Function 'cons' passed incorrect type!\n"
     "\tRecieved %s, expected %s",
-    ltype_name(a->cell[1]->type), ltype_name(LVAL_QEXPR));
+    ltype_name(lval_type(a->cell[1])), ltype_name(LVAL_QEXPR));
 
   lval *x = lval_pop(a, 0);
   lval *y = lval_pop(a, 0);
-  y = lval_push(y, x);
 
   lval_del(a);
-  return y;
+  return lval_cons(x, y);
 }
 
 lval *builtin_len( lenv *e, lval *a )  {
@@ -189,14 +178,14 @@ lval *builtin_len( lenv *e, lval *a )  {
     "Function 'len' passed too many arguments!\n"
     "\tRecieved %d, expected %d", a->count, 1);
 
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR,
     "Function 'len' passed incorrect type!\n"
     "\tRecieved %s, expected %s",
-    ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+    ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
 
   int len = a->cell[0]->count;
   lval_del(lval_take(a, 0));
-  return lval_num(len);
+  return lval_int(len);
 }
 
 lval *builtin_rev( lenv *e, lval *a )  {
@@ -204,16 +193,16 @@ lval *builtin_rev( lenv *e, lval *a )  {
     "Function 'rev' passed too many arguments!\n"
     "\tRecieved %d, expected %d", a->count, 1);
 
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR,
     "Function 'rev' passed incorrect type!\n"
     "\tRecieved %s, expected %s",
-    ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+    ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
 
   lval *x = lval_take(a, 0);
   lval *q = lval_qexpr();
 
-  while (x->count > 0)  {
-    q = lval_push(q, lval_pop(x, 0));
+  for ( int i = x->count - 1; i >= 0; i-- )  {
+    q = lval_add(q, lval_copy(x->cell[i]));
   }
 
   lval_del(x);
@@ -221,21 +210,21 @@ lval *builtin_rev( lenv *e, lval *a )  {
 }
 
 lval *builtin_if( lenv *e, lval *arguements )  {
-  LASSERT(arguements, arguements->count == 2,
-    "Function '?' passed too many arguments!\n"
-    "\tRecieved %d, expected %d", arguements->count, 2);
+  LASSERT(arguements, arguements->count == 3,
+    "Function '?' passed incorrect number of arguments!\n"
+    "\tRecieved %d, expected %d", arguements->count, 3);
 
-  LASSERT(arguements, (arguements->cell[0]->type != LVAL_QEXPR
-    && arguements->cell[0]->type != LVAL_SYM),
+  LASSERT(arguements, (lval_type(arguements->cell[0]) != LVAL_QEXPR
+    && lval_type(arguements->cell[0]) != LVAL_SYM),
     "Function '?' passed incorrect type!\n"
     "\tRecieved %s, expected %s or ",
-    ltype_name(arguements->cell[0]->type), ltype_name(LVAL_QEXPR), ltype_name(LVAL_SYM));
+    ltype_name(lval_type(arguements->cell[0])), ltype_name(LVAL_QEXPR), ltype_name(LVAL_SYM));
 
   for ( size_t i = 1; i < arguements->count; i++ )  {
-    LASSERT(arguements, arguements->cell[i]->type == LVAL_QEXPR,
+    LASSERT(arguements, lval_type(arguements->cell[i]) == LVAL_QEXPR,
       "Function '?' passed incorrect type!\n"
       "\tRecieved %s, expected %s",
-      ltype_name(arguements->cell[i]->type), ltype_name(LVAL_QEXPR));
+      ltype_name(lval_type(arguements->cell[i])), ltype_name(LVAL_QEXPR));
   }
 
   lval *clause = lval_pop(arguements, 0);
@@ -244,7 +233,7 @@ lval *builtin_if( lenv *e, lval *arguements )  {
   lval_del(arguements);
 
   lval *result = lval_eval(e, clause);
-  if ( result->num )  {
+  if ( lval_is_num(result) && lval_to_double(result) )  {
     lval_del(_else);
     lval_del(result);
     return then;
@@ -260,39 +249,39 @@ lval *builtin_bool( lenv *e, lval *arguements )  {
     "Function 'bool' passed too many arguments!\n"
     "\tRecieved %d, expected %d", arguements->count, 1);
 
-  LASSERT(arguements, arguements->cell[0]->type == LVAL_SYM,
+  LASSERT(arguements, lval_type(arguements->cell[0]) == LVAL_SYM,
     "Function 'bool' passed incorrect type!\n"
     "\tRecieved %s, expected %s",
-    ltype_name(arguements->cell[0]->type), ltype_name(LVAL_SYM));
+    ltype_name(lval_type(arguements->cell[0])), ltype_name(LVAL_SYM));
 
   lval *clause = lval_take(arguements, 0);
   lval *result = lval_eval(e, clause);
 
-  if ( result->type == LVAL_NUM )  {
+  if ( lval_is_num(result) )  {
     return result;
-  } else if ( result->type == LVAL_QEXPR )  {
+  } else if ( lval_type(result) == LVAL_QEXPR )  {
     // turn the qexpr into an argument
     // ( {qexpr} )
     lval *arguement = lval_add(lval_sexpr(), result);
     return builtin_len(e, arguement);
   }
   lval_del(result);
-  return lval_num(0);
+  return lval_int(0);
 }
 
 lval *builtin_var( lenv *e, lval *a, char *func )  {
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR,
     "Function '%s' passed incorrect type!\n"
     "\tRecieved %s, expected %s",
-    func, ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+    func, ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
 
   lval *syms = a->cell[0];
 
   for ( size_t i = 0; i < syms->count; i++ )  {
-    LASSERT(a, syms->cell[i]->type == LVAL_SYM,
+    LASSERT(a, lval_type(syms->cell[i]) == LVAL_SYM,
       "Function '%s' passed incorrect type!\n"
       "\tRecieved %s, expected %s",
-      func, ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+      func, ltype_name(lval_type(syms->cell[i])), ltype_name(LVAL_SYM));
   }
 
   LASSERT(a, (syms->count == a->count - 1),
@@ -322,43 +311,148 @@ lval *builtin_put( lenv *e, lval *a )  {
 }
 
 lval *builtin_env( lenv *e, lval *a )  {
+  lval_del(a);
+
   lval *exp = lval_qexpr();
 
   for ( size_t i = 0; i < e->count; i++ )  {
     lval *q = lval_qexpr();
     //
-    q = lval_add( q, lval_sym(e->syms[i]) );
-    q = lval_add( q, lval_copy(e->vals[i]) );
+    q = lval_add( q, e->ents[i].sym );
+    q = lval_add( q, lval_copy(e->ents[i].val) );
+    exp = lval_add(exp, q);
+  }
+
+  return exp;
+}
+
+// one row per heap type: {name live peak total bytes}
+lval *builtin_mem( lenv *e, lval *a )  {
+  lval_del(a);
+
+  lval *exp = lval_qexpr();
+
+  for ( size_t i = 0; i < LALLOC_KINDS; i++ )  {
+    lalloc_stats *s = lalloc_stat(i);
+    lval *q = lval_qexpr();
+
+    q = lval_add( q, lval_sym(lalloc_name(i)) );
+    q = lval_add( q, lval_int(s->live) );
+    q = lval_add( q, lval_int(s->peak) );
+    q = lval_add( q, lval_int(s->total) );
+    q = lval_add( q, lval_int(s->bytes) );
     exp = lval_add(exp, q);
   }
 
   return exp;
 }
 
+// run a major collection now, then report {minor major freed last max total}
+lval *builtin_gc( lenv *e, lval *a )  {
+  lval_del(a);
+  lgc_collect();
+
+  lgc_stats *s = lgc_stat();
+  lval *q = lval_qexpr();
+
+  q = lval_add( q, lval_int(s->minor) );
+  q = lval_add( q, lval_int(s->major) );
+  q = lval_add( q, lval_int(s->freed) );
+  q = lval_add( q, lval_num(s->last_pause) );
+  q = lval_add( q, lval_num(s->max_pause) );
+  q = lval_add( q, lval_num(s->total_pause) );
+  return q;
+}
+
+// (gc-tune nursery growth) minor collection every nursery new containers,
+// major once the heap is growth times what survived the last major
+lval *builtin_gc_tune( lenv *e, lval *a )  {
+  LASSERT(a, a->count == 2,
+    "Function 'gc-tune' passed incorrect number of arguments!\n"
+    "\tRecieved %d, expected %d", a->count, 2);
+
+  for ( size_t i = 0; i < 2; i++ )  {
+    LASSERT(a, lval_is_num(a->cell[i]),
+      "Function 'gc-tune' passed incorrect type!\n"
+      "\tRecieved %s, expected %s",
+      ltype_name(lval_type(a->cell[i])), ltype_name(LVAL_NUM));
+  }
+
+  LASSERT(a, lval_to_double(a->cell[0]) >= 1 && lval_to_double(a->cell[1]) >= 0,
+    "Function 'gc-tune' passed a negative threshold!");
+
+  lgc_tune(lval_to_double(a->cell[0]), lval_to_double(a->cell[1]));
+
+  lval_del(a);
+  return lval_sexpr();
+}
+
+// (max-depth n) how much evaluation can be pending at once, nested
+// expressions and calls that are not tail calls, before it is an error
+lval *builtin_max_depth( lenv *e, lval *a )  {
+  LASSERT(a, a->count == 1,
+    "Function 'max-depth' passed incorrect number of arguments!\n"
+    "\tRecieved %d, expected %d", a->count, 1);
+
+  LASSERT(a, lval_is_num(a->cell[0]),
+    "Function 'max-depth' passed incorrect type!\n"
+    "\tRecieved %s, expected %s",
+    ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_NUM));
+
+  LASSERT(a, lval_to_double(a->cell[0]) >= 1,
+    "Function 'max-depth' passed a limit below 1!");
+
+  lcode_tune(lval_to_double(a->cell[0]));
+
+  lval_del(a);
+  return lval_sexpr();
+}
+
+// (save-image {name}) snapshot the global env to name.img, for --image
+lval *builtin_save_image( lenv *e, lval *a )  {
+  LASSERT(a, a->count == 1,
+    "Function 'save-image' passed incorrect number of arguments!\n"
+    "\tRecieved %d, expected %d", a->count, 1);
+
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR && a->cell[0]->count == 1
+    && lval_is_sym(a->cell[0]->cell[0]),
+    "Function 'save-image' passed incorrect type!\n"
+    "\tRecieved %s, expected %s",
+    ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
+
+  lval *err = limage_save(e, lval_sym_name(a->cell[0]->cell[0]));
+  lval_del(a);
+  return err ? err : lval_sexpr();
+}
+
 lval *builtin_lambda( lenv *e, lval *a )  {
   LASSERT(a, a->count == 2,
     "Function '\\' passed too many arguments!\n"
     "\tRecieved %d, expected %d", a->count, 2);
 
   for ( size_t i = 0; i < 2; i++)  {
-    LASSERT(a, a->cell[i]->type == LVAL_QEXPR,
+    LASSERT(a, lval_type(a->cell[i]) == LVAL_QEXPR,
       "Function '\\' passed incorrect type!\n"
       "\tRecieved %s, expected %s",
-      ltype_name(a->cell[i]->type), ltype_name(LVAL_QEXPR));
+      ltype_name(lval_type(a->cell[i])), ltype_name(LVAL_QEXPR));
   }
 
   for ( size_t i = 0; i < a->cell[0]->count; i++)  {
-    LASSERT(a, a->cell[0]->cell[i]->type == LVAL_SYM,
+    LASSERT(a, lval_type(a->cell[0]->cell[i]) == LVAL_SYM,
       "Cannot define non-symbol!\n"
       "\tRecieved %s, expected %s",
-      ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+      ltype_name(lval_type(a->cell[0]->cell[i])), ltype_name(LVAL_SYM));
   }
 
+  lval *dup = lval_formals_dup(a->cell[0]);
+  LASSERT(a, !dup,
+    "Function '\\' passed formal '%s' more than once!", lval_sym_name(dup));
+
   lval *formals = lval_pop(a, 0);
   lval *body = lval_pop(a, 0);
   lval_del(a);
 
-  return lval_lambda(formals, body);
+  return lval_lambda(e, formals, body);
 }
 
 double power(double base, long exp)  {
@@ -1,102 +1,265 @@
 #include <stdio.h>
+#include <limits.h>
 #include "include.h"
 
 
 // any s expression get evaluated with below function
 // anything else gets left as is
 lval *lval_eval( lenv *e, lval *v )  {
-  if ( v->type == LVAL_SYM )  {
+  if ( lval_type(v) == LVAL_SYM )  {
     lval *x = lenv_get(e, v);
     lval_del(v);
 
     return x;
   }
-  if ( v->type == LVAL_SEXPR )  { return lval_eval_sexpr(e, v); }
+  if ( lval_type(v) == LVAL_REF )  {
+    lval *x = lenv_ref(e, v);
+    lval_del(v);
+
+    return x;
+  }
+  if ( lval_type(v) == LVAL_SEXPR )  { return lval_eval_sexpr(e, v); }
   return v;
 }
 
 // to evaluate an s expression ...
 // evaluate each individual members of the s expression
-// numbers and symbols stay as is, nested expressions get recursively evaluated
+// numbers and symbols stay as is, nested expressions get evaluated too
 // check if anything became an error
 // return empty expressions, take pulls the lval out of the s expression for unary
 // assert the first element is a symbol
+// the work is done by lcode_eval, on a stack of its own, see vm.c
 lval* lval_eval_sexpr( lenv *e, lval* v )  {
+  return lcode_eval(e, v);
+}
 
+// the function v applies, popped off the front of it. NULL if there is
+// none, with what v comes to instead in result
+lval *lval_callee( lval *v, lval **result )  {
   for ( size_t i = 0; i < v->count; i++ )  {
-    v->cell[i] = lval_eval(e, v->cell[i]);
-  }
-
-  for ( size_t i = 0; i < v->count; i++ )  {
-    if ( (v->cell[i])->type == LVAL_ERR )  { return lval_take(v, i); }
+    if ( lval_type(v->cell[i]) == LVAL_ERR )  {
+      *result = lval_take(v, i);
+      return NULL;
+    }
   }
 
   // empty expression
-  if ( v->count == 0 )  { return v; }
+  if ( v->count == 0 )  {
+    *result = v;
+    return NULL;
+  }
 
   // unary expression
-  if ( v->count == 1 )  { return lval_take(v, 0); }
+  if ( v->count == 1 )  {
+    *result = lval_take(v, 0);
+    return NULL;
+  }
 
   // assert the first element is a symbol
   lval *f = lval_pop(v, 0);
-  if ( f->type != LVAL_FUN )  {
+  if ( lval_type(f) != LVAL_FUN )  {
     lval_del(f);
     lval_del(v);
-    return lval_err("S-expression does not start with function!");
+    *result = lval_err("S-expression does not start with function!");
+    return NULL;
+  }
+  return f;
+}
+
+// one step of an integer fold. returns 0 when the exact answer does not
+// fit in a long, or is not an integer at all, so the caller can carry
+// on in doubles instead
+static int builtin_op_int( char *op, long *x, long y )  {
+  long r;
+
+  if ( strcmp(op, "+") == 0 )  {
+    if ( __builtin_add_overflow(*x, y, &r) )  { return 0; }
+  } else if ( strcmp(op, "-") == 0 )  {
+    if ( __builtin_sub_overflow(*x, y, &r) )  { return 0; }
+  } else if ( strcmp(op, "*") == 0 )  {
+    if ( __builtin_mul_overflow(*x, y, &r) )  { return 0; }
+  } else if ( strcmp(op, "/") == 0 )  {
+    if ( y == 0 || (y == -1 && *x == LONG_MIN) || *x % y )  { return 0; }
+    r = *x / y;
+  } else if ( strcmp(op, "%") == 0 )  {
+    if ( y == 0 )  { return 0; }
+    r = y == -1 ? 0 : *x % y;
+  } else if ( strcmp(op, "|") == 0 )  {
+    r = *x | y;
+  } else if ( strcmp(op, "&") == 0 )  {
+    r = *x & y;
+  } else if ( strcmp(op, "^") == 0 )  {
+    r = *x ^ y;
+  } else if ( strcmp(op, ">>") == 0 )  {
+    if ( y < 0 )  { return 0; }
+    r = y > 63 ? (*x < 0 ? -1 : 0) : *x >> y;
+  } else if ( strcmp(op, "<<") == 0 )  {
+    if ( y < 0 || y > 63 )  { return *x == 0 && y >= 0; }
+    r = (long)((unsigned long)*x << y);
+    if ( r >> y != *x )  { return 0; }
+  } else if ( strcmp(op, "**") == 0 )  {
+    if ( y < 0 )  { return 0; }
+    long base = *x;
+    r = 1;
+    for ( ; y; y >>= 1 )  {
+      if ( (y & 1) && __builtin_mul_overflow(r, base, &r) )  { return 0; }
+      if ( y > 1 && __builtin_mul_overflow(base, base, &base) )  { return 0; }
+    }
+  } else if ( strcmp(op, "max") == 0 )  {
+    r = *x > y ? *x : y;
+  } else if ( strcmp(op, "min") == 0 )  {
+    r = *x < y ? *x : y;
+  } else {
+    return 0;
   }
 
-  // do the calculation
-  lval *result = lval_call(e, f, v);
-  lval_del(f);
-  return result;
+  *x = r;
+  return 1;
 }
 
+// swap the running exact value for the result of a bignum step,
+// which comes back as a plain long whenever it fits
+static void builtin_op_exact( lval *r, long *n, lval **big )  {
+  if ( *big )  { lval_del(*big); }
+  *big = NULL;
+
+  if ( lval_type(r) == LVAL_INT )  {
+    *n = lval_to_int(r);
+    lval_del(r);
+  } else {
+    *big = r;
+  }
+}
+
+// whether d can be cast to a long, which the integer ops on doubles do.
+// the cast is undefined for anything else, nan included
+static int builtin_op_long( double d )  {
+  return d >= (double)LONG_MIN && d < -(double)LONG_MIN;
+}
 
 lval *builtin_op( lenv *e, lval *a, char *op )  {
+  int exact = 1;
+
   for ( size_t i = 0; i < a->count; i++ )  {
-    if ( a->cell[i]->type != LVAL_NUM )  {
+    if ( !lval_is_num(a->cell[i]) )  {
       lval_del(a);
       return lval_err("Cannot operate on non-number!");
     }
+    if ( lval_type(a->cell[i]) == LVAL_NUM )  { exact = 0; }
   }
 
-  lval *x = lval_pop(a, 0);
+  // operands are immediates, so we fold them straight out of the
+  // cell array instead of popping and freeing each one.
+  // integers stay exact, in a long while they fit and as a bignum once
+  // they don't. a step with no exact answer moves the rest of the fold
+  // over to doubles
+  long n = 0;
+  lval *big = NULL;
+  double x = lval_to_double(a->cell[0]);
+
+  if ( exact && lval_type(a->cell[0]) == LVAL_BIG )  {
+    big = lval_copy(a->cell[0]);
+  } else if ( exact )  {
+    n = lval_to_int(a->cell[0]);
+  }
 
   // unary methods
-  if ( a->count == 0 )  {
-    if ( strcmp(op, "-") == 0 ) { x->num = -x->num; }
-    if ( strcmp(op, "!") == 0 ) { x->num = !x->num; }
-    if ( strcmp(op, "~") == 0 ) { x->num = ~(long)x->num; }
+  if ( a->count == 1 && exact )  {
+    if ( strcmp(op, "!") == 0 ) {
+      n = !big && !n;
+      if ( big )  { lval_del(big); }
+      big = NULL;
+    } else if ( !big && strcmp(op, "~") == 0 ) {
+      n = ~n;
+    } else if ( !big && strcmp(op, "-") == 0 && n != LONG_MIN ) {
+      n = -n;
+    } else if ( strcmp(op, "-") == 0 || strcmp(op, "~") == 0 ) {
+      // -x and ~x are 0 - x and -1 - x
+      lval *acc = big ? lval_copy(big) : lval_int(n);
+      builtin_op_exact(lbig_op("-", lval_int(op[0] == '-' ? 0 : -1), acc), &n, &big);
+      lval_del(acc);
+    }
+  } else if ( a->count == 1 )  {
+    if ( strcmp(op, "-") == 0 ) { x = -x; }
+    if ( strcmp(op, "!") == 0 ) { x = !x; }
+    if ( strcmp(op, "~") == 0 ) {
+      if ( !builtin_op_long(x) )  {
+        lval_del(a);
+        return lval_err("Number out of range for '%s'!", op);
+      }
+      x = ~(long)x;
+    }
   }
 
-  while ( a->count > 0 )  {
-    lval *y = lval_pop(a, 0);
-
-    if ( strcmp(op, "+") == 0 ) { x->num += y->num; }
-    if ( strcmp(op, "-") == 0 ) { x->num -= y->num; }
-    if ( strcmp(op, "*") == 0 ) { x->num *= y->num; }
-    if ( strcmp(op, "/") == 0 ) {
-      if ( y->num == 0 )  {
-        lval_del(y);
-        lval_del(x);
-        x = lval_err("Division by zero!");
-        break;
+  for ( size_t i = 1; i < a->count; i++ )  {
+    lval *v = a->cell[i];
+
+    if ( exact )  {
+      if ( !big && lval_type(v) == LVAL_INT
+        && builtin_op_int(op, &n, lval_to_int(v)) )  { continue; }
+
+      lval *acc = big ? lval_copy(big) : lval_int(n);
+      lval *r = lbig_op(op, acc, v);
+
+      if ( r && lval_type(r) == LVAL_ERR )  {
+        lval_del(acc);
+        if ( big )  { lval_del(big); }
+        lval_del(a);
+        return r;
+      }
+      if ( r )  {
+        builtin_op_exact(r, &n, &big);
+        lval_del(acc);
+        continue;
+      }
+
+      exact = 0;
+      x = lval_to_double(acc);
+      lval_del(acc);
+      if ( big )  { lval_del(big); }
+      big = NULL;
+    }
+
+    double y = lval_to_double(a->cell[i]);
+
+    // the integer ops take their operands as longs, ** only its exponent
+    int ints = strcmp(op, "%") == 0 || strcmp(op, "|") == 0
+      || strcmp(op, "&") == 0 || strcmp(op, "^") == 0 || strcmp(op, ">>") == 0
+      || strcmp(op, "<<") == 0 || strcmp(op, "**") == 0;
+    if ( ints && (!builtin_op_long(y)
+      || (strcmp(op, "**") != 0 && !builtin_op_long(x))) )  {
+      lval_del(a);
+      return lval_err("Number out of range for '%s'!", op);
+    }
+
+    if ( strcmp(op, "+") == 0 ) { x += y; }
+    if ( strcmp(op, "-") == 0 ) { x -= y; }
+    if ( strcmp(op, "*") == 0 ) { x *= y; }
+    if ( strcmp(op, "/") == 0 || strcmp(op, "%") == 0 ) {
+      if ( y == 0 || (op[0] == '%' && (long)y == 0) )  {
+        lval_del(a);
+        return lval_err("Division by zero!");
+      }
+      if ( op[0] == '/' )  { x /= y; }
+    }
+    if ( strcmp(op, "%") == 0 ) { x = (long)y == -1 ? 0 : (long)x % (long)y; }
+    if ( strcmp(op, "|") == 0 ) { x = (long)x | (long)y; }
+    if ( strcmp(op, "&") == 0 ) { x = (long)x & (long)y; }
+    if ( strcmp(op, "^") == 0 ) { x = (long)x ^ (long)y; }
+    if ( strcmp(op, ">>") == 0 ) {
+      if ( y < 0 )  {
+        lval_del(a);
+        return lval_err("Number out of range for '%s'!", op);
       }
-      x->num /= y->num;
+      x = y > 63 ? ((long)x < 0 ? -1 : 0) : (long)x >> (long)y;
     }
-    if ( strcmp(op, "%") == 0 ) { x->num = (long)x->num % (long)y->num; }
-    if ( strcmp(op, "|") == 0 ) { x->num = (long)x->num | (long)y->num; }
-    if ( strcmp(op, "&") == 0 ) { x->num = (long)x->num & (long)y->num; }
-    if ( strcmp(op, "^") == 0 ) { x->num = (long)x->num ^ (long)y->num; }
-    if ( strcmp(op, ">>") == 0 ) { x->num = (long)x->num >> (long)y->num; }
-    if ( strcmp(op, "<<") == 0 ) { x->num = (long)x->num << (long)y->num; }
-    if ( strcmp(op, "**") == 0 ) { x->num = power(x->num, (long)y->num); }
-    if ( strcmp(op, "max") == 0 ) { x->num = max(x->num, y->num); }
-    if ( strcmp(op, "min") == 0 ) { x->num = min(x->num, y->num); }
-
-    lval_del(y);
+    if ( strcmp(op, "<<") == 0 ) { x = (long)x * power(2, (long)y); }
+    if ( strcmp(op, "**") == 0 ) { x = power(x, (long)y); }
+    if ( strcmp(op, "max") == 0 ) { x = max(x, y); }
+    if ( strcmp(op, "min") == 0 ) { x = min(x, y); }
   }
 
   lval_del(a);
-  return x;
+  if ( !exact )  { return lval_num(x); }
+  return big ? big : lval_int(n);
 }
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <time.h>
+#include "include.h"
+
+// reference counting frees a value the moment its last owner lets go,
+// which never happens for a cycle. this collector is the backstop: a
+// mark and sweep over the container lvals ( functions, s and q expressions
+// and the cell buffers behind them ) and the environments functions close
+// over, the only things that can point back at each other.
+//
+// roots are the containers referenced from outside the set being traced,
+// that is from the global environment, the C evaluation stack, or older
+// containers. rather than scanning the stack we subtract every reference
+// one traced container holds on another from the counts. whatever still
+// has a count left is a root.
+//
+// it is generational. new containers go on the young list, and a minor
+// collection traces only those before tenuring the survivors. anything
+// stored with lenv_put is tenured straight away. a major collection
+// traces the whole heap once the old generation has grown enough.
+//
+// nothing here moves: raw lval pointers live on the C stack, so a
+// copying nursery is not an option. the slabs already hand out memory
+// by free list pop or pointer bump.
+//
+// it only runs from lgc_maybe, at a point where every node is initialised
+
+#define LGC_NURSERY_DEFAULT  10000
+#define LGC_GROWTH_DEFAULT   2.0
+
+static long lgc_nursery = LGC_NURSERY_DEFAULT;
+static double lgc_growth = LGC_GROWTH_DEFAULT;
+static long lgc_old_limit = LGC_NURSERY_DEFAULT;
+
+static lgc_stats lgc_info;
+
+typedef struct {
+  lval **items;
+  int count;
+  int cap;
+} lgc_vec;
+
+// young containers, may hold stale or repeated entries until compacted
+static lgc_vec lgc_young;
+// the containers being traced by the current collection
+static lgc_vec lgc_scope;
+static lgc_vec lgc_stack;
+
+static const int lgc_kinds[] = { LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LALLOC_ENV };
+#define LGC_KINDS  ( sizeof(lgc_kinds) / sizeof(lgc_kinds[0]) )
+
+static void lgc_append( lgc_vec *v, lval *x )  {
+  if ( v->count == v->cap )  {
+    v->cap = v->cap ? v->cap * 2 : 256;
+    v->items = realloc(v->items, sizeof(lval*) * v->cap);
+  }
+  v->items[v->count++] = x;
+}
+
+static int lgc_container( lval *v )  {
+  if ( lval_is_imm(v) )  { return 0; }
+  return v->type == LVAL_FUN || v->type == LVAL_SEXPR
+    || v->type == LVAL_QEXPR || v->type == LVAL_CELLS || v->type == LALLOC_ENV;
+}
+
+static int lgc_scoped( lval *v )  {
+  return !lval_is_imm(v) && (v->gc & LGC_SCOPE);
+}
+
+// environments share the lval header, so they go through here cast
+static void lgc_children( lval *v, void (*fn)( lval* ) )  {
+  switch ( v->type )  {
+    case LVAL_FUN:
+      fn((lval*)v->env);
+      fn(v->formals);
+      fn(v->body);
+    break;
+    case LALLOC_ENV:  {
+      lenv *e = (lenv*)v;
+      if ( e->par )  { fn((lval*)e->par); }
+      for ( size_t i = 0; i < e->count; i++ )  { fn(e->ents[i].val); }
+    }
+    break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if ( v->buf )  {
+        fn(v->buf);
+      } else {
+        for ( size_t i = 0; i < v->count; i++ )  { fn(v->cell[i]); }
+      }
+    break;
+    case LVAL_CELLS:
+      for ( size_t i = v->low; i < v->high; i++ )  { fn(v->slot[i]); }
+    break;
+  }
+}
+
+static long lgc_live( void )  {
+  long n = 0;
+  for ( size_t i = 0; i < LGC_KINDS; i++ )  { n += lalloc_stat(lgc_kinds[i])->live; }
+  return n;
+}
+
+void lgc_track( lval *v )  {
+  lgc_append(&lgc_young, v);
+}
+
+static void lgc_tenure( lval *c )  {
+  if ( lgc_container(c) && !(c->gc & LGC_OLD) )  {
+    c->gc |= LGC_OLD;
+    lgc_append(&lgc_stack, c);
+  }
+}
+
+// values that make it into an environment are expected to live a while
+void lgc_promote( lval *v )  {
+  lgc_tenure(v);
+  while ( lgc_stack.count )  {
+    lgc_children(lgc_stack.items[--lgc_stack.count], lgc_tenure);
+  }
+}
+
+static void lgc_enter( lval *v )  {
+  v->gc |= LGC_SCOPE;
+  lgc_append(&lgc_scope, v);
+}
+
+static void lgc_enter_any( void *p )  {
+  lgc_enter(p);
+}
+
+// buffers are not on any list, we find them through the expressions
+// using them. a minor collection leaves tenured ones alone
+static void lgc_enter_cells( int all )  {
+  for ( size_t i = 0; i < lgc_scope.count; i++ )  {
+    lval *v = lgc_scope.items[i];
+    if ( v->type != LVAL_SEXPR && v->type != LVAL_QEXPR )  { continue; }
+
+    lval *b = v->buf;
+    if ( !b || (b->gc & LGC_SCOPE) )  { continue; }
+    if ( !all && (b->gc & LGC_OLD) )  { continue; }
+    lgc_enter(b);
+  }
+}
+
+// the young list can point at slots that were freed, refilled or
+// tenured since, so keep each live young container exactly once
+static void lgc_enter_young( void )  {
+  for ( size_t i = 0; i < lgc_young.count; i++ )  {
+    lval *v = lgc_young.items[i];
+    if ( lalloc_is_free(v) || !lgc_container(v) )  { continue; }
+    if ( v->type == LVAL_CELLS )  { continue; }
+    if ( v->gc & (LGC_OLD | LGC_SCOPE) )  { continue; }
+    lgc_enter(v);
+  }
+  lgc_young.count = 0;
+}
+
+static void lgc_unref( lval *c )  { if ( lgc_scoped(c) )  { c->rc--; } }
+static void lgc_reref( lval *c )  { if ( lgc_scoped(c) )  { c->rc++; } }
+
+static void lgc_mark( lval *c )  {
+  if ( !lgc_scoped(c) || (c->gc & LGC_MARK) )  { return; }
+  c->gc |= LGC_MARK;
+  lgc_append(&lgc_stack, c);
+}
+
+// drop the references a dead container holds on anything that survives
+static void lgc_release( lval *c )  {
+  if ( lgc_scoped(c) && (c->gc & LGC_MARK) == 0 )  { return; }
+
+  if ( !lval_is_imm(c) && c->type == LALLOC_ENV )  {
+    lenv_del((lenv*)c);
+  } else {
+    lval_del(c);
+  }
+}
+
+static void lgc_free( lval *v )  {
+  if ( v->type == LALLOC_ENV )  {
+    lenv_free((lenv*)v);
+  } else if ( v->type == LVAL_FUN )  {
+    lcode_del(v->code);
+    lfree(LVAL_FUN, v, LVAL_SIZE_FUN);
+  } else if ( v->type == LVAL_CELLS )  {
+    lfree(LVAL_CELLS, v, LVAL_SIZE_CELLS(v->cap));
+  } else {
+    lfree(v->type, v, LVAL_SIZE_EXPR);
+  }
+
+  lgc_info.freed++;
+}
+
+static void lgc_trace( void )  {
+  lval **scope = lgc_scope.items;
+  int n = lgc_scope.count;
+
+  // find the roots
+  for ( size_t i = 0; i < n; i++ )  { lgc_children(scope[i], lgc_unref); }
+  for ( size_t i = 0; i < n; i++ )  {
+    if ( scope[i]->rc > 0 )  { lgc_mark(scope[i]); }
+  }
+  for ( size_t i = 0; i < n; i++ )  { lgc_children(scope[i], lgc_reref); }
+
+  // mark everything they reach
+  while ( lgc_stack.count )  {
+    lgc_children(lgc_stack.items[--lgc_stack.count], lgc_mark);
+  }
+
+  // anything unmarked is only kept alive by a cycle
+  for ( size_t i = 0; i < n; i++ )  {
+    if ( !(scope[i]->gc & LGC_MARK) )  { lgc_children(scope[i], lgc_release); }
+  }
+
+  for ( size_t i = 0; i < n; i++ )  {
+    if ( scope[i]->gc & LGC_MARK )  {
+      scope[i]->gc = LGC_OLD;
+    } else {
+      lgc_free(scope[i]);
+    }
+  }
+
+  lgc_scope.count = 0;
+}
+
+static double lgc_now( void )  {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static void lgc_pause( double start )  {
+  double pause = lgc_now() - start;
+
+  lgc_info.last_pause = pause;
+  lgc_info.total_pause += pause;
+  if ( pause > lgc_info.max_pause )  { lgc_info.max_pause = pause; }
+}
+
+static void lgc_minor( void )  {
+  double start = lgc_now();
+
+  lgc_enter_young();
+  lgc_enter_cells(0);
+  lgc_trace();
+
+  lgc_info.minor++;
+  lgc_pause(start);
+}
+
+void lgc_collect( void )  {
+  double start = lgc_now();
+
+  lgc_young.count = 0;
+  for ( size_t i = 0; i < LGC_KINDS; i++ )  {
+    lalloc_each(lgc_kinds[i], lgc_enter_any);
+  }
+  lgc_enter_cells(1);
+  lgc_trace();
+
+  // let the old generation grow in proportion to what survived
+  long budget = lgc_live() * lgc_growth;
+  lgc_old_limit = budget > lgc_nursery ? budget : lgc_nursery;
+
+  lgc_info.major++;
+  lgc_pause(start);
+}
+
+void lgc_maybe( void )  {
+  if ( likely(lgc_young.count < lgc_nursery) )  { return; }
+
+  lgc_minor();
+  if ( lgc_live() > lgc_old_limit )  { lgc_collect(); }
+}
+
+void lgc_tune( long nursery, double growth )  {
+  lgc_nursery = nursery;
+  lgc_growth = growth;
+  lgc_old_limit = lgc_live() + nursery;
+}
+
+lgc_stats *lgc_stat( void )  {
+  return &lgc_info;
+}
@@ -0,0 +1,534 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "include.h"
+
+// a snapshot of the global environment that loads without going through
+// the reader or the evaluator.
+//
+// the file is a header, the symbol names, then every heap value children
+// first, then the environments. values refer to each other by words laid
+// out like lval words, except the payload of a heap word is the index of
+// a value in the file, of a symbol word the index of a name, and of a
+// builtin word its place in the builtin table. numbers are kept as is.
+// the environments come last because they are the only thing that can
+// be part of a cycle, a lambda in an env that the lambda closes over, so
+// they are made empty up front and filled in once the values exist.
+//
+// everything is in native byte order, an image is for the machine that
+// wrote it
+
+#define LIMAGE_MAGIC    "LISPYIMG"
+#define LIMAGE_VERSION  2
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t builtins;
+  uint32_t syms;
+  uint32_t envs;
+  uint32_t vals;
+} limage_head;
+
+// pointer to index, open addressing over a power of two table
+typedef struct {
+  void **keys;
+  uint32_t *vals;
+  uint32_t count;
+  uint32_t mask;
+} limage_map;
+
+// a value or env still to be numbered. a value is visited twice, once
+// to put its children on the stack above it and once more to number it
+// after they have been
+typedef struct {
+  void *p;
+  char env;
+  char done;
+} limage_todo;
+
+typedef struct {
+  FILE *f;
+  limage_map seen;
+  lval **syms;
+  lenv **envs;
+  lval **vals;
+  uint32_t nsyms;
+  uint32_t nenvs;
+  uint32_t nvals;
+  lval *err;
+  limage_todo *todo;
+  int ntodo;
+  int todocap;
+} limage_out;
+
+typedef struct {
+  char *p;
+  char *end;
+  lval **syms;
+  lenv **envs;
+  lval **vals;
+  uint32_t nsyms;
+  uint32_t nenvs;
+  uint32_t nvals;
+  int bad;
+} limage_in;
+
+static uint32_t limage_hash( void *p )  {
+  uint64_t x = (uint64_t)(uintptr_t)p;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return (uint32_t)x;
+}
+
+static void limage_map_grow( limage_map *m )  {
+  uint32_t size = m->mask ? (m->mask + 1) * 2 : 256;
+  void **keys = calloc(size, sizeof(void*));
+  uint32_t *vals = malloc(sizeof(uint32_t) * size);
+
+  for ( uint32_t i = 0; m->mask && i <= m->mask; i++ )  {
+    if ( !m->keys[i] )  { continue; }
+    uint32_t j = limage_hash(m->keys[i]) & (size - 1);
+    while ( keys[j] )  { j = (j + 1) & (size - 1); }
+    keys[j] = m->keys[i];
+    vals[j] = m->vals[i];
+  }
+
+  free(m->keys);
+  free(m->vals);
+  m->keys = keys;
+  m->vals = vals;
+  m->mask = size - 1;
+}
+
+// the index p was given, or -1
+static long limage_map_get( limage_map *m, void *p )  {
+  if ( !m->mask )  { return -1; }
+  for ( uint32_t i = limage_hash(p) & m->mask; m->keys[i]; i = (i + 1) & m->mask )  {
+    if ( m->keys[i] == p )  { return m->vals[i]; }
+  }
+  return -1;
+}
+
+static void limage_map_put( limage_map *m, void *p, uint32_t n )  {
+  if ( (m->count + 1) * 2 > m->mask + 1 )  { limage_map_grow(m); }
+
+  uint32_t i = limage_hash(p) & m->mask;
+  while ( m->keys[i] )  { i = (i + 1) & m->mask; }
+  m->keys[i] = p;
+  m->vals[i] = n;
+  m->count++;
+}
+
+static void *limage_append( void *items, uint32_t count, size_t size )  {
+  // grows at every power of two
+  if ( count & (count - 1) )  { return items; }
+  return realloc(items, size * (count ? count * 2 : 1));
+}
+
+static void limage_push( limage_out *o, void *p, int env )  {
+  if ( o->ntodo == o->todocap )  {
+    o->todocap = o->todocap ? o->todocap * 2 : 256;
+    o->todo = realloc(o->todo, sizeof(limage_todo) * o->todocap);
+  }
+  o->todo[o->ntodo++] = (limage_todo){ p, env, 0 };
+}
+
+// children are pushed last first, so they come off in order
+static void limage_push_children( limage_out *o, lval *v )  {
+  switch ( v->type )  {
+    case LVAL_FUN:
+      limage_push(o, v->body, 0);
+      limage_push(o, v->formals, 0);
+      limage_push(o, v->env, 1);
+    break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for ( size_t i = v->count; i-- > 0; )  { limage_push(o, v->cell[i], 0); }
+    break;
+    case LVAL_REF:
+      limage_push(o, v->var, 0);
+    break;
+  }
+}
+
+// an env is numbered as soon as it is reached, it is what breaks the
+// cycles between lambdas and the envs they close over
+static void limage_walk_env( limage_out *o, lenv *e )  {
+  if ( limage_map_get(&o->seen, e) >= 0 )  { return; }
+  limage_map_put(&o->seen, e, o->nenvs);
+  o->envs = limage_append(o->envs, o->nenvs, sizeof(lenv*));
+  o->envs[o->nenvs++] = e;
+
+  for ( size_t i = e->count; i-- > 0; )  {
+    limage_push(o, e->ents[i].val, 0);
+    limage_push(o, e->ents[i].sym, 0);
+  }
+  if ( e->par )  { limage_push(o, e->par, 1); }
+}
+
+// number every symbol, value and env reachable from e. values are
+// numbered after their children so the loader always has them first.
+// the walk keeps its own stack, however deep the values are nested
+static void limage_walk( limage_out *o, lenv *e )  {
+  limage_push(o, e, 1);
+
+  while ( o->ntodo )  {
+    limage_todo t = o->todo[--o->ntodo];
+    lval *v = t.p;
+
+    if ( t.env )  {
+      limage_walk_env(o, t.p);
+      continue;
+    }
+
+    if ( lval_is_sym(v) )  {
+      if ( limage_map_get(&o->seen, lval_to_sym(v)) >= 0 )  { continue; }
+      limage_map_put(&o->seen, lval_to_sym(v), o->nsyms);
+      o->syms = limage_append(o->syms, o->nsyms, sizeof(lval*));
+      o->syms[o->nsyms++] = v;
+      continue;
+    }
+
+    // a lambda can be reached again through its own env before it is
+    // numbered the first time round
+    if ( lval_is_imm(v) || limage_map_get(&o->seen, v) >= 0 )  { continue; }
+
+    if ( v->type == LVAL_ERR )  {
+      if ( !o->err )  { o->err = lval_err("Cannot save an error in an image!"); }
+      continue;
+    }
+
+    if ( !t.done )  {
+      limage_push(o, v, 0);
+      o->todo[o->ntodo - 1].done = 1;
+      limage_push_children(o, v);
+      continue;
+    }
+
+    limage_map_put(&o->seen, v, o->nvals);
+    o->vals = limage_append(o->vals, o->nvals, sizeof(lval*));
+    o->vals[o->nvals++] = v;
+  }
+}
+
+static void limage_write( limage_out *o, void *p, size_t size )  {
+  fwrite(p, size, 1, o->f);
+}
+
+static void limage_write_u32( limage_out *o, uint32_t x )  {
+  limage_write(o, &x, sizeof(x));
+}
+
+static void limage_write_word( limage_out *o, lval *v )  {
+  uint64_t w = (uint64_t)(uintptr_t)v;
+  uint64_t tag = w & LVAL_TAG_MASK;
+
+  if ( tag == 0 )  {
+    w = limage_map_get(&o->seen, v);
+  } else if ( tag == LVAL_SYM_TAG )  {
+    w = tag | limage_map_get(&o->seen, lval_to_sym(v));
+  } else if ( tag == LVAL_FUN_TAG )  {
+    w = tag | lenv_builtin_id(lval_to_builtin(v));
+  }
+
+  limage_write(o, &w, sizeof(w));
+}
+
+static void limage_write_val( limage_out *o, lval *v )  {
+  unsigned char type = v->type;
+  limage_write(o, &type, 1);
+
+  switch ( v->type )  {
+    case LVAL_INT:
+      limage_write(o, &v->num, sizeof(long));
+    break;
+    case LVAL_BIG:
+      limage_write(o, &v->sign, sizeof(int));
+      limage_write(o, &v->len, sizeof(int));
+      limage_write(o, v->limb, sizeof(uint32_t) * v->len);
+    break;
+    case LVAL_REF:
+      limage_write_word(o, v->var);
+      limage_write(o, &v->depth, sizeof(int));
+      limage_write(o, &v->at, sizeof(int));
+    break;
+    case LVAL_FUN:
+      limage_write_u32(o, limage_map_get(&o->seen, v->env));
+      limage_write_word(o, v->formals);
+      limage_write_word(o, v->body);
+    break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      limage_write_u32(o, v->count);
+      for ( size_t i = 0; i < v->count; i++ )  { limage_write_word(o, v->cell[i]); }
+    break;
+  }
+}
+
+static void limage_write_env( limage_out *o, lenv *e )  {
+  uint32_t par = e->par ? limage_map_get(&o->seen, e->par) : UINT32_MAX;
+
+  limage_write_u32(o, par);
+  limage_write_u32(o, e->frame);
+  limage_write_u32(o, e->extra);
+  limage_write_u32(o, e->count);
+  for ( size_t i = 0; i < e->count; i++ )  {
+    limage_write_word(o, e->ents[i].sym);
+    limage_write_word(o, e->ents[i].val);
+  }
+}
+
+// write out the global env e belongs to, and everything it can reach,
+// to name.img. name is a symbol name, so it is still about for an error
+lval *limage_save( lenv *e, char *name )  {
+  while ( e->par )  { e = e->par; }
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.img", name);
+
+  limage_out o = { 0 };
+  limage_walk(&o, e);
+
+  if ( !o.err )  {
+    o.f = fopen(path, "wb");
+    if ( !o.f )  { o.err = lval_err("Cannot write image '%s.img'!", name); }
+  }
+
+  if ( !o.err )  {
+    limage_head h = { LIMAGE_MAGIC, LIMAGE_VERSION, lenv_builtin_count(),
+      o.nsyms, o.nenvs, o.nvals };
+    limage_write(&o, &h, sizeof(h));
+
+    for ( uint32_t i = 0; i < o.nsyms; i++ )  {
+      char *s = lval_sym_name(o.syms[i]);
+      uint32_t len = strlen(s);
+      limage_write_u32(&o, len);
+      limage_write(&o, s, len);
+    }
+    for ( uint32_t i = 0; i < o.nvals; i++ )  { limage_write_val(&o, o.vals[i]); }
+    for ( uint32_t i = 0; i < o.nenvs; i++ )  { limage_write_env(&o, o.envs[i]); }
+
+    if ( ferror(o.f) | fclose(o.f) )  { o.err = lval_err("Cannot write image '%s.img'!", name); }
+  }
+
+  free(o.seen.keys);
+  free(o.seen.vals);
+  free(o.syms);
+  free(o.envs);
+  free(o.vals);
+  free(o.todo);
+  return o.err;
+}
+
+static void limage_read( limage_in *in, void *p, size_t size )  {
+  if ( in->bad || (size_t)(in->end - in->p) < size )  {
+    in->bad = 1;
+    memset(p, 0, size);
+    return;
+  }
+  memcpy(p, in->p, size);
+  in->p += size;
+}
+
+static uint32_t limage_read_u32( limage_in *in )  {
+  uint32_t x;
+  limage_read(in, &x, sizeof(x));
+  return x;
+}
+
+// the lval a word stands for, as a new reference
+static lval *limage_read_word( limage_in *in )  {
+  uint64_t w;
+  limage_read(in, &w, sizeof(w));
+
+  uint64_t tag = w & LVAL_TAG_MASK;
+  uint64_t n = w & LVAL_PTR_MASK;
+
+  if ( tag == 0 )  {
+    if ( n < in->nvals )  { return lval_copy(in->vals[n]); }
+  } else if ( tag == LVAL_SYM_TAG )  {
+    if ( n < in->nsyms )  { return in->syms[n]; }
+  } else if ( tag == LVAL_FUN_TAG )  {
+    if ( n < lenv_builtin_count() )  { return lval_fun(lenv_builtin(n)); }
+  } else {
+    return (lval*)(uintptr_t)w;
+  }
+
+  in->bad = 1;
+  return lval_sexpr();
+}
+
+static lval *limage_read_expr( limage_in *in, lval *v )  {
+  uint32_t count = limage_read_u32(in);
+  for ( uint32_t i = 0; i < count && !in->bad; i++ )  {
+    v = lval_add(v, limage_read_word(in));
+  }
+  return v;
+}
+
+static lval *limage_read_val( limage_in *in )  {
+  unsigned char type;
+  limage_read(in, &type, 1);
+
+  switch ( type )  {
+    case LVAL_INT:  {
+      long x;
+      limage_read(in, &x, sizeof(x));
+      return lval_int(x);
+    }
+    case LVAL_BIG:  {
+      int sign, len;
+      limage_read(in, &sign, sizeof(int));
+      limage_read(in, &len, sizeof(int));
+      if ( in->bad || len <= 0 || (size_t)len > (size_t)(in->end - in->p) / sizeof(uint32_t) )  {
+        break;
+      }
+      lval *v = lval_big(sign, len);
+      limage_read(in, v->limb, sizeof(uint32_t) * len);
+      return v;
+    }
+    case LVAL_REF:  {
+      lval *var = limage_read_word(in);
+      int depth, at;
+      limage_read(in, &depth, sizeof(int));
+      limage_read(in, &at, sizeof(int));
+      if ( !lval_is_sym(var) )  {
+        lval_del(var);
+        break;
+      }
+      return lval_ref(var, depth, at);
+    }
+    case LVAL_FUN:  {
+      uint32_t env = limage_read_u32(in);
+      if ( in->bad || env >= in->nenvs )  { break; }
+      lval *formals = limage_read_word(in);
+      lval *body = limage_read_word(in);
+      if ( lval_type(formals) != LVAL_QEXPR || lval_type(body) != LVAL_QEXPR )  {
+        in->bad = 1;
+      } else {
+        for ( size_t i = 0; i < formals->count; i++ )  {
+          if ( !lval_is_sym(formals->cell[i]) )  { in->bad = 1; }
+        }
+        if ( lval_formals_dup(formals) )  { in->bad = 1; }
+      }
+      return lval_closure(in->envs[env], formals, body);
+    }
+    case LVAL_SEXPR:
+      return limage_read_expr(in, lval_sexpr());
+    case LVAL_QEXPR:
+      return limage_read_expr(in, lval_qexpr());
+  }
+
+  in->bad = 1;
+  return lval_sexpr();
+}
+
+static void limage_read_env( limage_in *in, lenv *e )  {
+  uint32_t par = limage_read_u32(in);
+  e->frame = limage_read_u32(in) != 0;
+  int extra = limage_read_u32(in) != 0;
+  uint32_t count = limage_read_u32(in);
+
+  if ( par != UINT32_MAX )  {
+    if ( par >= in->nenvs )  { in->bad = 1; return; }
+    e->par = lenv_copy(in->envs[par]);
+  }
+
+  for ( uint32_t i = 0; i < count && !in->bad; i++ )  {
+    lval *k = limage_read_word(in);
+    lval *v = limage_read_word(in);
+    if ( lval_is_sym(k) )  {
+      lenv_put(e, k, v);
+    } else {
+      in->bad = 1;
+    }
+    lval_del(k);
+    lval_del(v);
+  }
+  e->extra = extra;
+}
+
+// the global env saved in path, or an error. path must outlive the error
+lval *limage_load( char *path, lenv **out )  {
+  int fd = open(path, O_RDONLY);
+  if ( fd < 0 )  { return lval_err("Cannot open image '%s'!", path); }
+
+  struct stat st;
+  off_t size = fstat(fd, &st) == 0 ? st.st_size : -1;
+  if ( size < (off_t)sizeof(limage_head) )  {
+    close(fd);
+    return lval_err("Image '%s' is not an image!", path);
+  }
+
+  char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if ( map == MAP_FAILED )  { return lval_err("Cannot open image '%s'!", path); }
+
+  limage_in in = { map, map + size };
+  limage_head h;
+  limage_read(&in, &h, sizeof(h));
+
+  if ( memcmp(h.magic, LIMAGE_MAGIC, sizeof(h.magic)) != 0
+    || h.version != LIMAGE_VERSION )  {
+    munmap(map, size);
+    return lval_err("Image '%s' is not an image!", path);
+  }
+  if ( h.builtins != lenv_builtin_count() || h.envs == 0 )  {
+    munmap(map, size);
+    return lval_err("Image '%s' was saved by a different lispy!", path);
+  }
+
+  // every symbol takes at least its length word, every value its type
+  // and every env its header, so a count bigger than that is a lie
+  size_t left = in.end - in.p;
+  if ( h.syms > left / 4 || h.vals > left || h.envs > left / 12 )  {
+    munmap(map, size);
+    return lval_err("Image '%s' is damaged!", path);
+  }
+
+  in.syms = malloc(sizeof(lval*) * h.syms);
+  in.envs = malloc(sizeof(lenv*) * h.envs);
+  in.vals = malloc(sizeof(lval*) * h.vals);
+
+  for ( ; in.nsyms < h.syms && !in.bad; in.nsyms++ )  {
+    uint32_t len = limage_read_u32(&in);
+    if ( len > (size_t)(in.end - in.p) )  { in.bad = 1; break; }
+
+    char *name = malloc(len + 1);
+    limage_read(&in, name, len);
+    name[len] = '\0';
+    in.syms[in.nsyms] = lval_sym(name);
+    free(name);
+  }
+
+  for ( ; in.nenvs < h.envs; in.nenvs++ )  { in.envs[in.nenvs] = lenv_new(); }
+  for ( ; in.nvals < h.vals && !in.bad; in.nvals++ )  {
+    in.vals[in.nvals] = limage_read_val(&in);
+  }
+  for ( uint32_t i = 0; i < h.envs && !in.bad; i++ )  { limage_read_env(&in, in.envs[i]); }
+
+  munmap(map, size);
+
+  // the table held one reference on everything, the env keeps what it needs
+  for ( uint32_t i = 0; i < in.nvals; i++ )  { lval_del(in.vals[i]); }
+  for ( uint32_t i = 1; i < in.nenvs; i++ )  { lenv_del(in.envs[i]); }
+
+  lval *err = NULL;
+  if ( in.bad )  {
+    err = lval_err("Image '%s' is damaged!", path);
+    lenv_del(in.envs[0]);
+    // a damaged image can leave envs and lambdas holding on to each other
+    lgc_collect();
+  } else {
+    *out = in.envs[0];
+  }
+
+  free(in.syms);
+  free(in.envs);
+  free(in.vals);
+  return err;
+}
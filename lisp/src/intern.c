@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include "include.h"
+
+// every symbol name is stored exactly once, in this table. lval_sym hands
+// out a tagged pointer to the entry, so two symbols are the same symbol
+// exactly when their words are equal and nothing has to compare, copy or
+// free the characters again. entries live for the life of the process
+static lsym **lsym_table = NULL;
+static size_t lsym_buckets = 0;
+static size_t lsym_count = 0;
+
+// fnv-1a
+static uint32_t lsym_hash( char *s, size_t len )  {
+  uint32_t h = 2166136261u;
+  for ( size_t i = 0; i < len; i++ )  {
+    h ^= (unsigned char)s[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void lsym_grow( void )  {
+  size_t n = lsym_buckets ? lsym_buckets * 2 : 256;
+  lsym **t = calloc(n, sizeof(lsym*));
+
+  for ( size_t i = 0; i < lsym_buckets; i++ )  {
+    lsym *x = lsym_table[i];
+    while ( x )  {
+      lsym *next = x->next;
+      x->next = t[x->hash & (n - 1)];
+      t[x->hash & (n - 1)] = x;
+      x = next;
+    }
+  }
+
+  free(lsym_table);
+  lsym_table = t;
+  lsym_buckets = n;
+}
+
+lval* lval_sym( char *s )  {
+  size_t len = strlen(s);
+  uint32_t h = lsym_hash(s, len);
+
+  if ( unlikely(lsym_count >= lsym_buckets) )  { lsym_grow(); }
+
+  lsym **b = &lsym_table[h & (lsym_buckets - 1)];
+  lsym *x;
+
+  for ( x = *b; x; x = x->next )  {
+    if ( x->hash == h && strcmp(x->name, s) == 0 )  { break; }
+  }
+
+  if ( !x )  {
+    x = lalloc(LVAL_SYM, sizeof(lsym) + len + 1);
+    x->hash = h;
+    memcpy(x->name, s, len + 1);
+    x->next = *b;
+    *b = x;
+    lsym_count++;
+  }
+
+  return (lval*)(uintptr_t)((uint64_t)(uintptr_t)x | LVAL_SYM_TAG);
+}
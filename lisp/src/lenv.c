@@ -1,77 +1,291 @@
 #include <stdio.h>
+#include <limits.h>
 #include "include.h"
 
+// environments up to this size are searched by scanning
+#define LENV_SMALL 8
+
+// call frames take their slots from a stack of chunks, each at least
+// this many entries
+#define LENV_CHUNK 4096
+
+typedef struct lchunk lchunk;
+struct lchunk {
+  lchunk *prev;
+  lchunk *next;
+  int top;
+  int cap;
+  lentry slot[];
+};
+
+static lchunk *lenv_stack = NULL;
+
+// bumped by every change to a global env, which is what tells a cached
+// global binding it may be stale. zero is never current
+unsigned long lenv_version = 1;
+
 lenv *lenv_new( void )  {
-  lenv *e = malloc( sizeof(lenv*) );
+  lenv *e = lalloc( LALLOC_ENV, sizeof(lenv) );
+  e->type = LALLOC_ENV;
+  e->gc = 0;
+  e->rc = 1;
   e->par = NULL;
+  e->frame = 0;
+  e->extra = 0;
+  e->arena = 0;
   e->count = 0;
-  e->syms = NULL;
-  e->vals = NULL;
+  e->cap = 0;
+  e->ents = NULL;
+  e->index = NULL;
+  e->mask = 0;
+
+  lgc_track((lval*)e);
   return e;
 }
 
 void lenv_del( lenv *e )  {
+  if ( --e->rc > 0 )  { return; }
+
   for ( size_t i = 0; i < e->count; i++ )  {
-    free(e->syms[i]);
-    lval_del(e->vals[i]);
+    lval_del(e->ents[i].val);
+  }
+  if ( e->par )  { lenv_del(e->par); }
+  lenv_free(e);
+}
+
+// give back the env itself, the values are the caller's problem
+void lenv_free( lenv *e )  {
+  if ( !e->frame )  { lenv_version++; }
+
+  if ( !e->arena )  { free(e->ents); }
+  free(e->index);
+  lfree(LALLOC_ENV, e, sizeof(lenv));
+}
+
+// n slots off the top of the frame stack. chunks are kept once made,
+// so a deep recursion only pays for them the first time
+static lentry *lenv_push( int n )  {
+  lchunk *c = lenv_stack;
+
+  if ( !c || c->top + n > c->cap )  {
+    lchunk *next = c ? c->next : NULL;
+
+    if ( !next || next->cap < n )  {
+      int cap = n > LENV_CHUNK ? n : LENV_CHUNK;
+      lchunk *x = malloc(sizeof(lchunk) + sizeof(lentry) * cap);
+      x->cap = cap;
+      x->prev = c;
+      x->next = next;
+      if ( next )  { next->prev = x; }
+      if ( c )  { c->next = x; }
+      next = x;
+    }
+
+    next->top = 0;
+    c = lenv_stack = next;
+  }
+
+  lentry *p = c->slot + c->top;
+  c->top += n;
+  return p;
+}
+
+static void lenv_pop( int n )  {
+  lenv_stack->top -= n;
+  if ( lenv_stack->top == 0 && lenv_stack->prev )  { lenv_stack = lenv_stack->prev; }
+}
+
+// move a frame's ents off the frame stack into room for cap of them
+static void lenv_spill( lenv *e, int cap )  {
+  lentry *ents = malloc(sizeof(lentry) * cap);
+  memcpy(ents, e->ents, sizeof(lentry) * e->count);
+  e->ents = ents;
+  e->cap = cap;
+  e->arena = 0;
+}
+
+// a frame for a call binding n arguments. most never outlive the call,
+// so the env is not tracked by the collector and its slots come off the
+// frame stack, to be given back in order by lenv_leave
+lenv *lenv_enter( lenv *par, int n )  {
+  lenv *e = lalloc( LALLOC_ENV, sizeof(lenv) );
+  e->type = LALLOC_ENV;
+  e->gc = 0;
+  e->rc = 1;
+  e->par = lenv_copy(par);
+  e->frame = 1;
+  e->extra = 0;
+  e->arena = n > 0;
+  e->count = 0;
+  e->cap = n;
+  e->ents = n > 0 ? lenv_push(n) : NULL;
+  e->index = NULL;
+  e->mask = 0;
+  return e;
+}
+
+// the call is over. a frame some closure has captured moves to the heap
+// first, and from then on it is the collector's to look after
+void lenv_leave( lenv *e, int n )  {
+  if ( e->rc > 1 )  {
+    if ( e->arena )  { lenv_spill(e, e->cap); }
+    lgc_track((lval*)e);
+  }
+
+  lenv_del(e);
+  if ( n > 0 )  { lenv_pop(n); }
+}
+
+// the entry bound to k in this env alone, or NULL
+static lentry *lenv_find( lenv *e, lval *k )  {
+  if ( !e->index )  {
+    for ( size_t i = 0; i < e->count; i++ )  {
+      if ( e->ents[i].sym == k )  { return &e->ents[i]; }
+    }
+    return NULL;
+  }
+
+  // linear probing, there are no deletions so no tombstones either
+  for ( uint32_t i = lval_to_sym(k)->hash & e->mask; e->index[i] >= 0;
+    i = (i + 1) & e->mask )  {
+    if ( e->ents[e->index[i]].sym == k )  { return &e->ents[e->index[i]]; }
+  }
+  return NULL;
+}
+
+// size the index for twice the capacity of ents, so it stays at most
+// half full, and put every entry back in
+static void lenv_reindex( lenv *e )  {
+  int size = 16;
+  while ( size < e->cap * 2 )  { size *= 2; }
+
+  free(e->index);
+  e->index = malloc(sizeof(int) * size);
+  e->mask = size - 1;
+  memset(e->index, -1, sizeof(int) * size);
+
+  for ( int n = 0; n < e->count; n++ )  {
+    uint32_t i = lval_to_sym(e->ents[n].sym)->hash & e->mask;
+    while ( e->index[i] >= 0 )  { i = (i + 1) & e->mask; }
+    e->index[i] = n;
   }
-  free(e->syms);
-  free(e->vals);
-  free(e);
 }
 
 lval *lenv_get( lenv *e, lval *k )  {
-  for ( size_t i = 0; i < e->count; i++ )  {
-    if ( strcmp(e->syms[i], k->sym) == 0 )  {
-      return lval_copy(e->vals[i]);
+  for ( lenv *x = e; x; x = x->par )  {
+    lentry *n = lenv_find(x, k);
+    if ( n )  { return lval_copy(n->val); }
+  }
+
+  // maybe a module/symbol
+  return lmod_get(e, k);
+}
+
+// what k is bound to in e itself, or NULL
+lval *lenv_get_local( lenv *e, lval *k )  {
+  lentry *x = lenv_find(e, k);
+  return x ? lval_copy(x->val) : NULL;
+}
+
+// the slot k is bound to in e itself, or -1
+int lenv_slot( lenv *e, lval *k )  {
+  lentry *x = lenv_find(e, k);
+  return x ? (int)(x - e->ents) : -1;
+}
+
+// a resolved variable, see lval_resolve. the frames between the one we
+// were handed and the one the variable was found in only hold what their
+// calls bound, none of which is the variable, so they are passed by
+// without a look. one with extra names could shadow it, and then it is
+// looked up by name. so is a slot that doesn't hold the variable, which
+// is what a partial application leaves, with one frame more in between.
+// a global is cached once the walk gets past the frames, and kept until
+// a global env changes
+lval *lenv_ref( lenv *e, lval *r )  {
+  lenv *x = e;
+  int d = r->at < 0 ? INT_MAX : r->depth;
+  for ( ; d > 0 && x->frame; d-- )  {
+    if ( x->extra )  { return lenv_get(e, r->var); }
+    x = x->par;
+  }
+
+  if ( r->at < 0 )  {
+    if ( r->ver == lenv_version )  { return lval_copy(r->val); }
+
+    lval *v = lenv_get(x, r->var);
+    if ( lval_type(v) != LVAL_ERR )  {
+      r->val = v;
+      r->ver = lenv_version;
     }
+    return v;
   }
 
-  if ( e->par )  {
-    return lenv_get(e->par, k);
-  } else {
-    return lval_err("Unbound Symbol :: '%s'", k->sym);
+  if ( d == 0 && r->at < x->count && x->ents[r->at].sym == r->var )  {
+    return lval_copy(x->ents[r->at].val);
   }
+  return lenv_get(e, r->var);
 }
 
 void lenv_put( lenv *e, lval *k, lval *v )  {
-  for ( size_t i = 0; i < e->count; i++ )  {
-    if ( strcmp( e->syms[i], k->sym ) == 0 )  {
-      lval_del(e->vals[i]);
-      e->vals[i] = lval_copy(v);
-      return;
+  if ( !e->frame )  { lenv_version++; }
+
+  lentry *x = lenv_find(e, k);
+  if ( x )  {
+    lval_del(x->val);
+    x->val = lval_copy(v);
+    lgc_promote(v);
+    return;
+  }
+
+  // room doubles, so a run of definitions is amortized O(1) each
+  if ( e->count == e->cap )  {
+    int cap = e->cap ? e->cap * 2 : 4;
+    if ( e->arena )  {
+      lenv_spill(e, cap);
+    } else {
+      e->cap = cap;
+      e->ents = realloc( e->ents, sizeof(lentry) * e->cap );
     }
+    if ( e->cap > LENV_SMALL )  { lenv_reindex(e); }
   }
 
-  // we havent found it yet so we need to realloc space
-  e->count++;
+  if ( e->frame )  { e->extra = 1; }
 
-  e->vals = realloc( e->vals, sizeof(lval*) * e->count );
-  e->syms = realloc( e->syms, sizeof(char*) * e->count );
+  int n = e->count++;
+  e->ents[n].sym = k;
+  e->ents[n].val = lval_copy(v);
+  lgc_promote(v);
 
-  e->vals[e->count - 1] = lval_copy(v);
-  e->syms[e->count - 1] = malloc( strlen(k->sym) + 1 );
-  strcpy( e->syms[e->count - 1], k->sym );
+  if ( e->index )  {
+    uint32_t i = lval_to_sym(k)->hash & e->mask;
+    while ( e->index[i] >= 0 )  { i = (i + 1) & e->mask; }
+    e->index[i] = n;
+  }
 }
 
+// the n values in a bound to formals by position, in a frame fresh from
+// lenv_enter, which takes them over. the formals of a lambda are all
+// different, so there is nothing to look up first. the values are not
+// promoted either: the frame isn't traced while the call runs, and most
+// of them die with it
+void lenv_bind( lenv *e, lval *formals, lval **a, int n )  {
+  for ( int i = 0; i < n; i++ )  {
+    e->ents[i].sym = formals->cell[i];
+    e->ents[i].val = a[i];
+  }
+  e->count = n;
+}
+
+// the nearest env that is not a call frame, the global env or a module's
 void lenv_def( lenv *e, lval *k, lval *v )  {
-  while ( e->par ) { e = e->par; }
+  while ( e->frame ) { e = e->par; }
   lenv_put(e, k, v);
 }
 
+// envs are shared, so a copy is just another reference
 lenv *lenv_copy( lenv *e )  {
-  lenv *n = malloc( sizeof(lenv) );
-  n->par = e->par;
-  n->count = e->count;
-  n->syms = malloc( sizeof(char*) * n->count );
-  n->vals = malloc( sizeof(lval*) * n->count );
-
-  for ( size_t i = 0; i < e->count; i++ )  {
-    n->syms[i] = malloc( strlen(e->syms[i]) + 1 );
-    strcpy( n->syms[i], e->syms[i] );
-    n->vals[i] = lval_copy(e->vals[i]);
-  }
-  return n;
+  e->rc++;
+  return e;
 }
 
 void lenv_add_builtin( lenv *e, char *name, lbuiltin func )  {
@@ -84,37 +298,71 @@ void lenv_add_builtin( lenv *e, char *name, lbuiltin func )  {
   lval_del(v);
 }
 
+// every builtin, in the order they are registered. an image refers to
+// a builtin by its place in here, so new ones only ever go on the end
+static const struct {
+  char *name;
+  lbuiltin func;
+} lenv_builtins[] = {
+  { "list", builtin_list },
+  { "tail", builtin_tail },
+  { "head", builtin_head },
+  { "join", builtin_join },
+  { "eval", builtin_eval },
+  { "init", builtin_init },
+  { "cons", builtin_cons },
+  { "len", builtin_len },
+  { "rev", builtin_rev },
+  { "?", builtin_if },
+  { "bool", builtin_bool },
+  { "def", builtin_def },
+
+  { "+", builtin_add },
+  { "-", builtin_sub },
+  { "*", builtin_mul },
+  { "/", builtin_div },
+  { "%", builtin_mod },
+  { "&", builtin_bwand },
+  { "|", builtin_bwor },
+  { "!", builtin_not },
+  { "~", builtin_neg },
+  { "^", builtin_xor },
+  { "**", builtin_pow },
+  { ">>", builtin_rshift },
+  { "<<", builtin_lshift },
+  { "min", builtin_min },
+  { "max", builtin_max },
+  { "env", builtin_env },
+  { "quit", builtin_quit },
+  { "\\", builtin_lambda },
+  { "=", builtin_put },
+  { "mem", builtin_mem },
+  { "gc", builtin_gc },
+  { "gc-tune", builtin_gc_tune },
+  { "save-image", builtin_save_image },
+  { "export", builtin_export },
+  { "max-depth", builtin_max_depth },
+};
+
+#define LENV_BUILTINS  ( sizeof(lenv_builtins) / sizeof(lenv_builtins[0]) )
+
 void lenv_add_builtins( lenv *e )  {
-  lenv_add_builtin( e, "list", builtin_list );
-  lenv_add_builtin( e, "tail", builtin_tail );
-  lenv_add_builtin( e, "head", builtin_head );
-  lenv_add_builtin( e, "join", builtin_join );
-  lenv_add_builtin( e, "eval", builtin_eval );
-  lenv_add_builtin( e, "init", builtin_init );
-  lenv_add_builtin( e, "cons", builtin_cons );
-  lenv_add_builtin( e, "len", builtin_len );
-  lenv_add_builtin( e, "rev", builtin_rev );
-  lenv_add_builtin( e, "?", builtin_if );
-  lenv_add_builtin( e, "bool", builtin_bool );
-  lenv_add_builtin( e, "def", builtin_def );
-
-  lenv_add_builtin( e, "+", builtin_add );
-  lenv_add_builtin( e, "-", builtin_sub );
-  lenv_add_builtin( e, "*", builtin_mul );
-  lenv_add_builtin( e, "/", builtin_div );
-  lenv_add_builtin( e, "%", builtin_mod );
-  lenv_add_builtin( e, "&", builtin_bwand );
-  lenv_add_builtin( e, "|", builtin_bwor );
-  lenv_add_builtin( e, "!", builtin_not );
-  lenv_add_builtin( e, "~", builtin_neg );
-  lenv_add_builtin( e, "^", builtin_xor );
-  lenv_add_builtin( e, "**", builtin_pow );
-  lenv_add_builtin( e, ">>", builtin_rshift );
-  lenv_add_builtin( e, "<<", builtin_lshift );
-  lenv_add_builtin( e, "min", builtin_min );
-  lenv_add_builtin( e, "max", builtin_max );
-  lenv_add_builtin( e, "env", builtin_env );
-  lenv_add_builtin( e, "quit", builtin_quit );
-  lenv_add_builtin( e, "\\", builtin_lambda );
-  lenv_add_builtin( e, "=", builtin_put );
+  for ( size_t i = 0; i < LENV_BUILTINS; i++ )  {
+    lenv_add_builtin( e, lenv_builtins[i].name, lenv_builtins[i].func );
+  }
+}
+
+int lenv_builtin_count( void )  {
+  return LENV_BUILTINS;
+}
+
+lbuiltin lenv_builtin( int id )  {
+  return lenv_builtins[id].func;
+}
+
+int lenv_builtin_id( lbuiltin func )  {
+  for ( size_t i = 0; i < LENV_BUILTINS; i++ )  {
+    if ( lenv_builtins[i].func == func )  { return i; }
+  }
+  return -1;
 }
@@ -2,213 +2,562 @@
 #include "include.h"
 
 lval* lval_num( double x )  {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_NUM;
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+
+  // every nan shares one payload so the encoding can never overflow
+  if ( x != x )  { bits = LVAL_CANON_NAN; }
+
+  return (lval*)(uintptr_t)(bits + LVAL_NUM_OFFSET);
+}
+
+// every heap lval comes through here, sized for its type
+static lval *lval_alloc( int type, size_t size )  {
+  lval *v = lalloc(type, size);
+  v->type = type;
+  v->gc = 0;
+  v->rc = 1;
+
+  if ( type == LVAL_FUN || type == LVAL_SEXPR || type == LVAL_QEXPR )  {
+    lgc_track(v);
+  }
+  return v;
+}
+
+lval* lval_int( long x )  {
+  // anything that survives the round trip through 48 bits is immediate
+  if ( (long)((uint64_t)x << 16) >> 16 == x )  {
+    return (lval*)(uintptr_t)(((uint64_t)x & LVAL_PTR_MASK) | LVAL_INT_TAG);
+  }
+
+  lval *v = lval_alloc(LVAL_INT, LVAL_SIZE_INT);
   v->num = x;
   return v;
 }
 
+// limbs are left for the caller to fill in
+lval* lval_big( int sign, int len )  {
+  lval *v = lval_alloc(LVAL_BIG, LVAL_SIZE_BIG(len));
+  v->sign = sign;
+  v->len = len;
+  return v;
+}
+
+// step over a printf conversion, returning its conversion character.
+// fmt points just past the '%'
+static char lval_err_spec( char **fmt, int *wide )  {
+  char *p = *fmt;
+  *wide = 0;
+
+  while ( *p && strchr("-+ #0123456789.", *p) )  { p++; }
+  while ( *p == 'l' || *p == 'z' )  { *wide = 1; p++; }
+
+  *fmt = *p ? p + 1 : p;
+  return *p;
+}
+
+// errors are often made only to be thrown away again, by a probe or a
+// failed assertion nobody prints. so we only keep the format and its
+// arguments, and leave the formatting to lval_err_format.
+// fmt and any %s arguments must outlive the error, which holds for the
+// string literals and interned symbol names we pass in
 lval* lval_err( char *fmt, ... )  {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_ERR;
+  lval *v = lval_alloc(LVAL_ERR, LVAL_SIZE_ERR);
+  v->fmt = fmt;
+  v->argc = 0;
 
   va_list va;
   va_start(va, fmt);
 
-  v->err = malloc(512);
-
-  vsnprintf( v->err, 511, fmt, va );
-
-  v->err = realloc( v->err, strlen(v->err) + 1 );
+  for ( char *p = fmt; (p = strchr(p, '%')); )  {
+    p++;
+    if ( *p == '%' )  { p++; continue; }
+
+    int wide;
+    char c = lval_err_spec(&p, &wide);
+    if ( v->argc == LERR_ARGS )  { break; }
+
+    lerr_arg *arg = &v->argv[v->argc++];
+    switch ( c )  {
+      case 's': arg->s = va_arg(va, char*); break;
+      case 'f':
+      case 'g':
+      case 'e': arg->f = va_arg(va, double); break;
+      default: arg->i = wide ? va_arg(va, long) : va_arg(va, int); break;
+    }
+  }
 
   va_end(va);
   return v;
 }
 
-lval* lval_sym( char *s )  {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_SYM;
-  v->sym = malloc(strlen(s) + 1);
-  strcpy(v->sym, s);
-  return v;
+void lval_err_format( lval *v, char *buf, size_t size )  {
+  char *out = buf;
+  char *end = buf + size;
+  int n = 0;
+
+  for ( char *p = v->fmt; *p && out < end - 1; )  {
+    if ( *p != '%' || p[1] == '%' )  {
+      *out++ = *p;
+      p += *p == '%' ? 2 : 1;
+      continue;
+    }
+
+    // format one conversion at a time with its own argument
+    char spec[32];
+    char *start = p++;
+    int wide;
+    char c = lval_err_spec(&p, &wide);
+
+    size_t len = p - start < sizeof(spec) ? p - start : sizeof(spec) - 1;
+    memcpy(spec, start, len);
+    spec[len] = '\0';
+
+    lerr_arg arg = n < v->argc ? v->argv[n++] : (lerr_arg){ .i = 0 };
+    int w;
+    switch ( c )  {
+      case 's': w = snprintf(out, end - out, spec, arg.s); break;
+      case 'f':
+      case 'g':
+      case 'e': w = snprintf(out, end - out, spec, arg.f); break;
+      default:
+        w = wide ? snprintf(out, end - out, spec, arg.i)
+                 : snprintf(out, end - out, spec, (int)arg.i);
+      break;
+    }
+
+    out += w < end - out ? w : end - out - 1;
+  }
+
+  *out = '\0';
 }
 
 lval* lval_sexpr( void )  {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_SEXPR;
+  lval *v = lval_alloc(LVAL_SEXPR, LVAL_SIZE_EXPR);
+  v->cell = v->small;
   v->count = 0;
-  v->cell = NULL;
+  v->buf = NULL;
   return v;
 }
 
 lval* lval_qexpr( void )  {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_QEXPR;
+  lval *v = lval_alloc(LVAL_QEXPR, LVAL_SIZE_EXPR);
+  v->cell = v->small;
   v->count = 0;
-  v->cell = NULL;
+  v->buf = NULL;
   return v;
 }
 
 lval* lval_fun( lbuiltin func )  {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
-  v->builtin = func;
+  return (lval*)(uintptr_t)((uint64_t)(uintptr_t)func | LVAL_FUN_TAG);
+}
+
+// var as slot at of the call frame depth frames out from the one of the
+// lambda it is in, or at -1 for a global variable
+lval *lval_ref( lval *var, int depth, int at )  {
+  lval *v = lval_alloc(LVAL_REF, LVAL_SIZE_REF);
+  v->var = var;
+  v->depth = depth;
+  v->at = at;
+  v->val = NULL;
+  v->ver = 0;
   return v;
 }
 
-lval *lval_lambda( lval *formals, lval *body )  {
-  lval *v = malloc( sizeof(lval) );
-  v->type = LVAL_FUN;
+// the slot a parameter is bound to when the lambda is called, which is
+// its place in the formals, see lenv_bind
+static int lval_slot( lval *formals, lval *k )  {
+  for ( size_t i = 0; i < formals->count; i++ )  {
+    if ( formals->cell[i] == k )  { return i; }
+  }
+  return -1;
+}
 
-  v->builtin = NULL;
+// a symbol that is in formals more than once, or NULL. a lambda can't
+// have one, its arguments are bound by position
+lval *lval_formals_dup( lval *formals )  {
+  for ( size_t i = 0; i < formals->count; i++ )  {
+    for ( size_t j = 0; j < i; j++ )  {
+      if ( formals->cell[j] == formals->cell[i] )  { return formals->cell[i]; }
+    }
+  }
+  return NULL;
+}
 
-  v->env = lenv_new();
+// where k will be found by the body of a lambda over e: a parameter of
+// its own, in the call frame at depth 0, or a binding in one of the frames
+// the lambda is made in, which its call frame will have as parents.
+// a variable bound in none of them is global
+static lval *lval_resolve_sym( lenv *e, lval *formals, lval *k )  {
+  int at = lval_slot(formals, k);
+  if ( at >= 0 )  { return lval_ref(k, 0, at); }
+
+  for ( int depth = 1; e->frame; e = e->par, depth++ )  {
+    at = lenv_slot(e, k);
+    if ( at >= 0 )  { return lval_ref(k, depth, at); }
+  }
+  return lval_ref(k, 0, -1);
+}
 
+// swap variables for the frame and slot they will be bound in when the
+// lambda is called, so evaluating one is a short walk, an index and a
+// compare instead of a lookup, or for a cache of their global binding.
+// only expressions that will be evaluated are resolved: q expressions
+// in the body are data until somebody evals them, and must keep their
+// symbols. a lambda made by the body resolves its own when it is made
+//
+// nested expressions are gone through from a stack of their own, each
+// made private before its cells are swapped
+static lval *lval_resolve( lenv *e, lval *v, lval *formals )  {
+  v = lval_own(v);
+
+  int count = 1;
+  int cap = 16;
+  lval **todo = malloc(sizeof(lval*) * cap);
+  todo[0] = v;
+
+  while ( count )  {
+    lval *x = todo[--count];
+
+    for ( size_t i = 0; i < x->count; i++ )  {
+      lval *c = x->cell[i];
+
+      if ( lval_is_sym(c) )  {
+        x->cell[i] = lval_resolve_sym(e, formals, c);
+      } else if ( lval_type(c) == LVAL_SEXPR )  {
+        if ( count == cap )  {
+          cap *= 2;
+          todo = realloc(todo, sizeof(lval*) * cap);
+        }
+        todo[count++] = x->cell[i] = lval_own(c);
+      }
+    }
+  }
+
+  free(todo);
+  return v;
+}
+
+// a lambda closes over the env it is made in
+lval *lval_lambda( lenv *e, lval *formals, lval *body )  {
+  return lval_closure(e, formals, lval_resolve(e, body, formals));
+}
+
+// a lambda over e whose body has already been through lval_resolve
+lval *lval_closure( lenv *e, lval *formals, lval *body )  {
+  lval *v = lval_alloc(LVAL_FUN, LVAL_SIZE_FUN);
+  v->env = lenv_copy(e);
   v->formals = formals;
   v->body = body;
+  v->code = NULL;
   return v;
 }
 
+// values are immutable once shared, so a copy is just another reference
 lval *lval_copy( lval *v )  {
-  lval *x = malloc( sizeof(lval) );
-  x->type = v->type;
+  if ( !lval_is_imm(v) )  { v->rc++; }
+  return v;
+}
 
-  switch ( x->type )  {
-    case LVAL_NUM:
-      x->num = v->num;
-    break;
+static lval *lval_cells( int cap )  {
+  lval *b = lval_alloc(LVAL_CELLS, LVAL_SIZE_CELLS(cap));
+  b->cap = cap;
+  b->low = 0;
+  b->high = 0;
+  return b;
+}
+
+// a second window onto the same cells, unless nobody else holds v.
+// inline cells cannot be shared, the new window gets its own references
+static lval *lval_window( lval *v )  {
+  if ( v->rc == 1 )  { return v; }
+
+  lval *x = lval_alloc(v->type, LVAL_SIZE_EXPR);
+  x->count = v->count;
+  x->buf = v->buf;
+
+  if ( x->buf )  {
+    x->cell = v->cell;
+    x->buf->rc++;
+  } else {
+    x->cell = x->small + (v->cell - v->small);
+    for ( size_t i = 0; i < v->count; i++ )  { x->cell[i] = lval_copy(v->cell[i]); }
+  }
+
+  v->rc--;
+  return x;
+}
+
+// give an expression cells that nobody else can see, holding exactly
+// its own elements, so they can be mutated in place
+static void lval_unshare( lval *v )  {
+  lval *b = v->buf;
+  if ( !b )  { return; }
+
+  if ( b->rc > 1 )  {
+    lval *n = NULL;
+    if ( v->count )  {
+      n = lval_cells(v->count);
+      for ( size_t i = 0; i < v->count; i++ )  {
+        n->slot[i] = lval_copy(v->cell[i]);
+      }
+      n->high = v->count;
+    }
+
+    lval_del(b);
+    v->buf = n;
+    v->cell = n ? n->slot : v->small;
+    return;
+  }
+
+  // drop whatever windows we used to share with left behind
+  int start = v->cell - b->slot;
+  for ( int i = b->low; i < start; i++ )  { lval_del(b->slot[i]); }
+  for ( int i = start + v->count; i < b->high; i++ )  { lval_del(b->slot[i]); }
+  b->low = start;
+  b->high = start + v->count;
+}
+
+// take a reference we are allowed to mutate. if nobody else holds v we
+// keep it, otherwise we make a one level copy whose children are shared
+lval *lval_own( lval *v )  {
+  if ( lval_is_imm(v) )  { return v; }
+
+  switch ( v->type )  {
     case LVAL_FUN:
-      if ( !v->builtin )  {
-        x->builtin = NULL;
+      if ( v->rc > 1 )  {
+        lval *x = lval_alloc(LVAL_FUN, LVAL_SIZE_FUN);
         x->env = lenv_copy(v->env);
         x->formals = lval_copy(v->formals);
         x->body = lval_copy(v->body);
-      } else {
-        x->builtin = v->builtin;
+        x->code = lcode_copy(v->code);
+        v->rc--;
+        v = x;
       }
     break;
-    case LVAL_ERR:
-      x->err = malloc( strlen(v->err) + 1 );
-      strcpy(x->err, v->err);
-    break;
-    case LVAL_SYM:
-      x->sym = malloc( strlen(v->sym) + 1 );
-      strcpy(x->sym, v->sym);
-    break;
     case LVAL_QEXPR:
     case LVAL_SEXPR:
-      x->count = v->count;
-      x->cell = malloc( sizeof(lval*) * v->count );
-      for ( size_t i = 0; i < x->count; i++ )  {
-        x->cell[i] = lval_copy(v->cell[i]);
-      }
+      v = lval_window(v);
+      lval_unshare(v);
     break;
   }
 
-  return x;
+  return v;
 }
 
+// values whose last reference is gone, waiting to be freed. whatever
+// dies along with one of them is put on here too instead of being freed
+// from inside it, so letting go of a deeply nested list takes no stack
+static lval **lval_dead = NULL;
+static int lval_dead_count = 0;
+static int lval_dead_cap = 0;
+static int lval_freeing = 0;
+
+static void lval_free( lval *v );
+
 void lval_del( lval *v )  {
+  if ( lval_is_imm(v) )  { return; }
+  if ( --v->rc > 0 )  { return; }
+
+  // already freeing further up, it gets to this one
+  if ( lval_freeing )  {
+    if ( lval_dead_count == lval_dead_cap )  {
+      lval_dead_cap = lval_dead_cap ? lval_dead_cap * 2 : 256;
+      lval_dead = realloc(lval_dead, sizeof(lval*) * lval_dead_cap);
+    }
+    lval_dead[lval_dead_count++] = v;
+    return;
+  }
+
+  lval_freeing = 1;
+  lval_free(v);
+  while ( lval_dead_count )  { lval_free(lval_dead[--lval_dead_count]); }
+  lval_freeing = 0;
+}
+
+static void lval_free( lval *v )  {
+  size_t size = LVAL_SIZE_EXPR;
+
   switch ( v->type )  {
-    case LVAL_NUM: break;
     case LVAL_FUN:
-      if ( !v->builtin )  {
-        lenv_del(v->env);
-        lval_del(v->formals);
-        lval_del(v->body);
-      }
+      lenv_del(v->env);
+      lval_del(v->formals);
+      lval_del(v->body);
+      lcode_del(v->code);
+      size = LVAL_SIZE_FUN;
+    break;
+
+    case LVAL_ERR:
+      size = LVAL_SIZE_ERR;
+    break;
+
+    case LVAL_INT:
+      size = LVAL_SIZE_INT;
+    break;
+
+    case LVAL_BIG:
+      size = LVAL_SIZE_BIG(v->len);
+    break;
+
+    case LVAL_REF:
+      size = LVAL_SIZE_REF;
     break;
-    case LVAL_ERR: free(v->err); break;
-    case LVAL_SYM: free(v->sym); break;
 
     case LVAL_QEXPR:
     case LVAL_SEXPR:
-      for ( size_t i = 0; i < v->count; i++ )  {
-        lval_del(v->cell[i]);
+      if ( v->buf )  {
+        lval_del(v->buf);
+      } else {
+        for ( size_t i = 0; i < v->count; i++ )  { lval_del(v->cell[i]); }
       }
+    break;
 
-      free(v->cell);
+    case LVAL_CELLS:
+      for ( size_t i = v->low; i < v->high; i++ )  {
+        lval_del(v->slot[i]);
+      }
+      size = LVAL_SIZE_CELLS(v->cap);
     break;
   }
 
-  free(v);
+  lfree(v->type, v, size);
 }
 
-lval *lval_call( lenv *e, lval *f, lval *a )  {
-  if ( f->builtin )  { return f->builtin(e, a); }
-
+// f applied to other than all of its formals, consumes both f and a.
+// partially applied, the rest of the formals are bound by a later call.
+// the arguments go in a frame of their own over the env the lambda was
+// made in, the lambda itself is left alone for everyone else sharing it.
+// that frame only binds formals, like a call's, so it has no extra names
+lval *lval_partial( lval *f, lval *a )  {
   int given = a->count;
   int total = f->formals->count;
 
-  while ( a->count )  {
-    if ( f->formals->count == 0 )  {
-      lval_del(a);
-      return lval_err("Function passed too many arguements!\n"
-      "Recieved %d, expected %d", given, total);
-    }
-
-    lval *sym = lval_pop(f->formals, 0);
-    lval *val = lval_pop(a, 0);
-
-    lenv_put(f->env, sym, val);
-
-    lval_del(sym);
-    lval_del(val);
+  if ( given > total )  {
+    lval_del(a);
+    lval_del(f);
+    return lval_err("Function passed too many arguements!\n"
+    "Recieved %d, expected %d", given, total);
   }
 
+  lenv *frame = lenv_new();
+  frame->frame = 1;
+  frame->par = lenv_copy(f->env);
+  for ( size_t i = 0; i < given; i++ )  {
+    lenv_put(frame, f->formals->cell[i], a->cell[i]);
+  }
+  frame->extra = 0;
   lval_del(a);
 
-  if ( f->formals->count == 0 )  {
-    f->env->par = e;
-    return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-  } else {
-    return lval_copy(f);
-  }
+  lval *p = lval_alloc(LVAL_FUN, LVAL_SIZE_FUN);
+  p->env = frame;
+  p->formals = lval_copy(f->formals);
+  p->body = lval_copy(f->body);
+  p->code = lcode_copy(f->code);
+  for ( size_t i = 0; i < given; i++ )  { p->formals = lval_tail(p->formals); }
+  lval_del(f);
+  return p;
+}
+
+// f applied to all of its formals, the n values in a, which the frame
+// over the env f was made in takes over. the frame goes back with
+// lenv_leave. f itself is left as it is, for everyone else sharing it
+lenv *lval_bind( lval *f, lval **a, int n )  {
+  lenv *frame = lenv_enter(f->env, n);
+  lenv_bind(frame, f->formals, a, n);
+
+  if ( !f->code )  { f->code = lcode_compile(f->body); }
+  return frame;
 }
 
 
 char *ltype_name( int t )  {
   switch ( t )  {
     case LVAL_NUM: return "Number";
+    case LVAL_INT: return "Integer";
+    case LVAL_BIG: return "Big Integer";
+    case LVAL_REF: return "Reference";
     case LVAL_SYM: return "Symbol";
     case LVAL_FUN: return "Function";
     case LVAL_QEXPR: return "Q-Expression";
     case LVAL_SEXPR: return "S-Expression";
     case LVAL_ERR: return "Error";
+    case LVAL_CELLS: return "Cells";
     default: return "Unknown";
   }
 }
 
 
+// make room for at least front more cells before cell[0] and back more
+// after cell[count - 1]. capacity doubles, so growing is amortized O(1).
+// the cells must already be unshared
+static void lval_reserve( lval *v, int front, int back )  {
+  lval *b = v->buf;
+  int head = v->cell - (b ? b->slot : v->small);
+  int cap = b ? b->cap : LVAL_INLINE;
+
+  if ( head >= front && cap - head - v->count >= back )  { return; }
+
+  // still fits inline, just slide the cells over
+  if ( !b && v->count + front + back <= LVAL_INLINE )  {
+    memmove(v->small + front, v->cell, sizeof(lval*) * v->count);
+    v->cell = v->small + front;
+    return;
+  }
+
+  cap *= 2;
+  if ( cap < v->count + front + back )  { cap = v->count + front + back; }
+
+  // growing for a push leaves half the slack at the front, otherwise
+  // keep the head room we already had
+  head = front ? (cap - v->count) / 2 : head;
+  if ( head < front )  { head = front; }
+
+  lval *n = lval_cells(cap);
+  if ( v->count )  { memcpy(n->slot + head, v->cell, sizeof(lval*) * v->count); }
+  n->low = head;
+  n->high = head + v->count;
+
+  // the elements moved over with the pointers, so free an empty buffer
+  if ( b )  {
+    b->high = b->low;
+    lval_del(b);
+  }
+
+  v->buf = n;
+  v->cell = n->slot + head;
+}
+
 lval *lval_add( lval *v, lval *x )  {
-  v->count++;
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-  v->cell[v->count - 1] = x;
+  lval_reserve(v, 0, 1);
+  v->cell[v->count++] = x;
+  if ( v->buf )  { v->buf->high++; }
   return v;
 }
 
 lval *lval_pop( lval* v, int i )  {
   lval *x = v->cell[i];
 
-  // move the data after element i forward by one slot
-  memmove(&v->cell[i], &v->cell[i + 1],
-    sizeof(lval*) * (v->count-i-1));
+  if ( i < v->count / 2 )  {
+    // close the gap from the front and hand the slot to the head room
+    memmove(&v->cell[1], &v->cell[0], sizeof(lval*) * i);
+    v->cell++;
+    if ( v->buf )  { v->buf->low++; }
+  } else {
+    memmove(&v->cell[i], &v->cell[i + 1],
+      sizeof(lval*) * (v->count - i - 1));
+    if ( v->buf )  { v->buf->high--; }
+  }
 
   v->count--;
-
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
   return x;
 }
 
 lval *lval_push( lval *v, lval *x )  {
+  lval_reserve(v, 1, 0);
 
-  // give the pointer more space ( +1 to be exact )
+  v->cell--;
+  if ( v->buf )  { v->buf->low--; }
   v->count++;
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-
-  // move all of the data forward by one slot
-  memmove(&v->cell[1], &v->cell[0],
-    sizeof(lval*) * (v->count - 1));
 
   // stick the new element in slot 0
   v->cell[0] = x;
@@ -223,10 +572,81 @@ lval *lval_take( lval *v, int i )  {
   return x;
 }
 
+// q becomes the s expression it quotes, ready to be evaluated
+lval *lval_unquote( lval *q )  {
+  q = lval_own(q);
+  lalloc_move(LVAL_QEXPR, LVAL_SEXPR, LVAL_SIZE_EXPR);
+  q->type = LVAL_SEXPR;
+  return q;
+}
+
+// the persistent list operations below consume v but never disturb
+// anyone else's view of its cells, so they work on shared lists without
+// copying them
+
+lval *lval_tail( lval *v )  {
+  v = lval_window(v);
+  lval *b = v->buf;
+
+  // nobody else can see the first cell, let go of it now
+  if ( !b )  {
+    lval_del(v->cell[0]);
+  } else if ( b->rc == 1 && v->cell == b->slot + b->low )  {
+    lval_del(b->slot[b->low++]);
+  }
+
+  v->cell++;
+  v->count--;
+  return v;
+}
+
+lval *lval_init( lval *v )  {
+  v = lval_window(v);
+  lval *b = v->buf;
+
+  if ( !b )  {
+    lval_del(v->cell[v->count - 1]);
+  } else if ( b->rc == 1 && v->cell + v->count == b->slot + b->high )  {
+    lval_del(b->slot[--b->high]);
+  }
+
+  v->count--;
+  return v;
+}
+
+lval *lval_cons( lval *x, lval *v )  {
+  v = lval_window(v);
+  lval *b = v->buf;
+
+  // no window starts before ours, so the slot in front of it is free
+  if ( b && v->cell == b->slot + b->low && b->low > 0 )  {
+    b->slot[--b->low] = x;
+    v->cell--;
+    v->count++;
+    return v;
+  }
+
+  lval_unshare(v);
+  return lval_push(v, x);
+}
+
+// the mirror of cons: no window ends after ours, so the spare slots
+// behind it are free to claim. a list that keeps being joined onto
+// grows its buffer by doubling instead of being copied every time
 lval *lval_join( lval *x, lval *y )  {
-  while ( y->count )  {
-    lval_add(x, lval_pop(y, 0));
+  x = lval_window(x);
+  lval *b = x->buf;
+
+  if ( !b || x->cell + x->count != b->slot + b->high
+    || b->cap - b->high < y->count )  {
+    lval_unshare(x);
+    lval_reserve(x, 0, y->count);
+  }
+
+  for ( size_t i = 0; i < y->count; i++ )  {
+    x->cell[x->count++] = lval_copy(y->cell[i]);
   }
+  if ( x->buf )  { x->buf->high = x->cell + x->count - x->buf->slot; }
 
   lval_del(y);
   return x;
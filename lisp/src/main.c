@@ -5,29 +5,25 @@
 
 int main( int argc, char** argv )  {
 
-  mpc_parser_t *Number    = mpc_new("number");
-  mpc_parser_t *Symbol    = mpc_new("symbol");
-  mpc_parser_t *Sexpr     = mpc_new("sexpr");
-  mpc_parser_t *Qexpr     = mpc_new("qexpr");
-  mpc_parser_t *Expr      = mpc_new("expr");
-  mpc_parser_t *Lispy     = mpc_new("lispy");
-
-  mpca_lang(MPCA_LANG_DEFAULT,
-  "                                                       \
-    number    : /[0-9]+(\\.[0-9]*)?/ ;                    \
-    symbol    : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&|^~?%]+/ ;   \
-    sexpr     : '(' <expr>* ')' ;                         \
-    qexpr     : '{' <expr>* '}' ;                         \
-    expr      : <number> | <symbol> | <sexpr> | <qexpr> ; \
-    lispy     : /^/ <expr>* /$/ ;                         \
-  ",
-  Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+  mpc_parser_t *Lispy = lval_grammar();
 
   puts("  🤖 :: Lispy Version 0.0.0.0.1");
   puts("  🚫 :: Use `quit` to Exit");
 
-  lenv *e = lenv_new();
-  lenv_add_builtins(e);
+  // lispy --image name.img starts from a saved global env
+  lenv *e = NULL;
+  if ( argc == 3 && strcmp(argv[1], "--image") == 0 )  {
+    lval *err = limage_load(argv[2], &e);
+    if ( err )  {
+      lval_println(err);
+      lval_del(err);
+    }
+  }
+
+  if ( !e )  {
+    e = lenv_new();
+    lenv_add_builtins(e);
+  }
 
   while ( likely(1) )  {
     char *input = readline("lispy> ");
@@ -52,7 +48,7 @@ int main( int argc, char** argv )  {
 
   lenv_del(e);
 
-  mpc_cleanup(6, Number, Symbol, Expr, Sexpr, Qexpr, Lispy);
+  lval_grammar_cleanup();
 
   return 0;
 }
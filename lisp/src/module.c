@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include "include.h"
+
+// a module is a file of parenthesised forms, name.lspy, read into an env
+// of its own the first time anything refers to one of its symbols as
+// name/sym. the env sits between the module's code and the global env,
+// so def in a module binds there and the global env never sees it. only
+// what the module lists with export can be reached from outside.
+// a name with a / in it is a path, lib/math/sq is sq from lib/math.lspy.
+// paths stay below the directory lispy runs in
+
+typedef struct {
+  lval *name;
+  lenv *env;
+  lval *exports;
+} lmodule;
+
+static lmodule **lmod_list = NULL;
+static int lmod_count = 0;
+static int lmod_cap = 0;
+
+static lmodule *lmod_find( lval *name )  {
+  for ( int i = 0; i < lmod_count; i++ )  {
+    if ( lmod_list[i]->name == name )  { return lmod_list[i]; }
+  }
+  return NULL;
+}
+
+static void lmod_drop( lmodule *m )  {
+  int i = 0;
+  while ( lmod_list[i] != m )  { i++; }
+  memmove(&lmod_list[i], &lmod_list[i + 1], sizeof(lmodule*) * (lmod_count - i - 1));
+  lmod_count--;
+
+  lval_del(m->exports);
+  lenv_del(m->env);
+  free(m);
+}
+
+// a module name is a path below the directory lispy runs in. every part
+// of it must be a name, so no leading /, no empty parts and no . or ..
+// that would reach anywhere else
+static int lmod_name_ok( char *s )  {
+  for ( char *p = s; ; )  {
+    size_t len = strcspn(p, "/");
+    if ( len == 0 )  { return 0; }
+    if ( (len == 1 && p[0] == '.') || (len == 2 && p[0] == '.' && p[1] == '.') )  {
+      return 0;
+    }
+    if ( !p[len] )  { return 1; }
+    p += len + 1;
+  }
+}
+
+// read and run name.lspy for the lookup of k. the module is registered
+// before its code runs so it can refer to itself, and dropped again if
+// any of it fails
+static lval *lmod_load( lenv *root, lval *name, lval *k, lmodule **out )  {
+  char *s = lval_sym_name(name);
+  if ( !lmod_name_ok(s) )  {
+    return lval_err("Module name '%s' must be a relative path without . or ..!", s);
+  }
+
+  char path[4096];
+  if ( snprintf(path, sizeof(path), "%s.lspy", s) >= (int) sizeof(path) )  {
+    return lval_err("Module name '%s' is too long!", s);
+  }
+
+  // no such module, k is just a symbol with a slash in it
+  FILE *f = fopen(path, "r");
+  if ( !f )  { return lval_err("Unbound Symbol :: '%s'", lval_sym_name(k)); }
+  fclose(f);
+
+  lval *x = lval_read_file(path);
+  if ( !x )  { return lval_err("Cannot load module '%s'!", s); }
+
+  if ( lmod_count == lmod_cap )  {
+    lmod_cap = lmod_cap ? lmod_cap * 2 : 8;
+    lmod_list = realloc(lmod_list, sizeof(lmodule*) * lmod_cap);
+  }
+
+  lmodule *m = malloc(sizeof(lmodule));
+  m->name = name;
+  m->env = lenv_new();
+  m->env->par = lenv_copy(root);
+  m->exports = lval_qexpr();
+  lmod_list[lmod_count++] = m;
+
+  while ( x->count )  {
+    lval *r = lval_eval(m->env, lval_pop(x, 0));
+    if ( lval_type(r) == LVAL_ERR )  {
+      lval_del(x);
+      lmod_drop(m);
+      return r;
+    }
+    lval_del(r);
+  }
+
+  lval_del(x);
+  *out = m;
+  return NULL;
+}
+
+// k is unbound in e. if it is name/sym, the value sym has in module name
+lval *lmod_get( lenv *e, lval *k )  {
+  char *s = lval_sym_name(k);
+  char *slash = strrchr(s, '/');
+
+  if ( !slash || slash == s || !slash[1] )  {
+    return lval_err("Unbound Symbol :: '%s'", s);
+  }
+
+  char *prefix = strndup(s, slash - s);
+  lval *name = lval_sym(prefix);
+  lval *sym = lval_sym(slash + 1);
+  free(prefix);
+
+  lmodule *m = lmod_find(name);
+  if ( !m )  {
+    while ( e->par )  { e = e->par; }
+    lval *err = lmod_load(e, name, k, &m);
+    if ( err )  { return err; }
+  }
+
+  int exported = 0;
+  for ( size_t i = 0; i < m->exports->count; i++ )  {
+    exported |= m->exports->cell[i] == sym;
+  }
+  if ( !exported )  {
+    return lval_err("Module '%s' does not export '%s'!",
+      lval_sym_name(name), lval_sym_name(sym));
+  }
+
+  lval *v = lenv_get_local(m->env, sym);
+  if ( !v )  {
+    return lval_err("Module '%s' exports '%s' but never defines it!",
+      lval_sym_name(name), lval_sym_name(sym));
+  }
+  return v;
+}
+
+// the module whose code is running in e, or NULL at the top level
+static lmodule *lmod_current( lenv *e )  {
+  while ( e->frame )  { e = e->par; }
+
+  for ( int i = 0; i < lmod_count; i++ )  {
+    if ( lmod_list[i]->env == e )  { return lmod_list[i]; }
+  }
+  return NULL;
+}
+
+// (export {syms}) make syms reachable as module/sym
+lval *builtin_export( lenv *e, lval *a )  {
+  LASSERT(a, a->count == 1,
+    "Function 'export' passed incorrect number of arguments!\n"
+    "\tRecieved %d, expected %d", a->count, 1);
+
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR,
+    "Function 'export' passed incorrect type!\n"
+    "\tRecieved %s, expected %s",
+    ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
+
+  lval *syms = a->cell[0];
+  for ( size_t i = 0; i < syms->count; i++ )  {
+    LASSERT(a, lval_is_sym(syms->cell[i]),
+      "Function 'export' passed incorrect type!\n"
+      "\tRecieved %s, expected %s",
+      ltype_name(lval_type(syms->cell[i])), ltype_name(LVAL_SYM));
+  }
+
+  lmodule *m = lmod_current(e);
+  LASSERT(a, m, "Function 'export' used outside of a module!");
+
+  m->exports = lval_join(m->exports, lval_pop(a, 0));
+  lval_del(a);
+  return lval_sexpr();
+}
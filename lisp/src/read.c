@@ -2,8 +2,63 @@
 #include "include.h"
 #include "mpc.h"
 
+// the grammar is shared by the repl and by modules read from files
+static mpc_parser_t *lval_parsers[6];
+
+mpc_parser_t *lval_grammar( void )  {
+  mpc_parser_t **p = lval_parsers;
+  if ( p[5] )  { return p[5]; }
+
+  p[0] = mpc_new("number");
+  p[1] = mpc_new("symbol");
+  p[2] = mpc_new("sexpr");
+  p[3] = mpc_new("qexpr");
+  p[4] = mpc_new("expr");
+  p[5] = mpc_new("lispy");
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+  "                                                       \
+    number    : /[0-9]+(\\.[0-9]*)?/ ;                    \
+    symbol    : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&|^~?%]+/ ;   \
+    sexpr     : '(' <expr>* ')' ;                         \
+    qexpr     : '{' <expr>* '}' ;                         \
+    expr      : <number> | <symbol> | <sexpr> | <qexpr> ; \
+    lispy     : /^/ <expr>* /$/ ;                         \
+  ",
+  p[0], p[1], p[2], p[3], p[4], p[5]);
+
+  return p[5];
+}
+
+void lval_grammar_cleanup( void )  {
+  mpc_parser_t **p = lval_parsers;
+  if ( p[5] )  { mpc_cleanup(6, p[0], p[1], p[4], p[2], p[3], p[5]); }
+}
+
+// every expression in a file, as one s expression, or NULL when it does
+// not parse. the reason has been printed by then
+lval *lval_read_file( char *path )  {
+  mpc_result_t r;
+  if ( !mpc_parse_contents(path, lval_grammar(), &r) )  {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    return NULL;
+  }
+
+  lval *x = lval_read(r.output);
+  mpc_ast_delete(r.output);
+  return x;
+}
+
 lval* lval_read_num( mpc_ast_t *t )  {
   errno = 0;
+
+  // integer literals are always exact
+  if ( !strchr(t->contents, '.') )  {
+    long n = strtol(t->contents, NULL, 10);
+    return errno != ERANGE ? lval_int(n) : lbig_read(t->contents);
+  }
+
   double x = strtod(t->contents, NULL);
 
   return errno != ERANGE ?
@@ -37,35 +92,68 @@ lval* lval_read( mpc_ast_t* t )  {
 // PRINTING
 //
 
-void lval_expr_print( lval *v, char open, char close )  {
+// what is left to print, values and the brackets and spaces between
+// them, last first. kept off the C stack so a deeply nested list prints
+// like any other
+typedef struct {
+  lval *v;
+  char c;
+} lprint;
+
+static lprint *lprint_todo = NULL;
+static int lprint_count = 0;
+static int lprint_cap = 0;
+
+static void lprint_push( lval *v, char c )  {
+  if ( lprint_count == lprint_cap )  {
+    lprint_cap = lprint_cap ? lprint_cap * 2 : 256;
+    lprint_todo = realloc(lprint_todo, sizeof(lprint) * lprint_cap);
+  }
+  lprint_todo[lprint_count++] = (lprint){ v, c };
+}
+
+static void lval_expr_print( lval *v, char open, char close )  {
   putchar(open);
-  for ( size_t i = 0; i < v->count; i++ )  {
-    lval_print(v->cell[i]);
-    if ( i != v->count - 1 )  {
-      putchar(' ');
-    }
+  lprint_push(NULL, close);
+  for ( size_t i = v->count; i-- > 0; )  {
+    lprint_push(v->cell[i], 0);
+    if ( i > 0 )  { lprint_push(NULL, ' '); }
   }
-  putchar(close);
 }
 
-void lval_print( lval *v )  {
-  switch ( v->type )  {
+static void lval_print_one( lval *v )  {
+  switch ( lval_type(v) )  {
     case LVAL_NUM:
-      printf( "%.2f", v->num );
+      printf( "%.2f", lval_to_num(v) );
+    break;
+    case LVAL_INT:
+      printf( "%ld", lval_to_int(v) );
     break;
-    case LVAL_ERR:
-      printf( "  🚩 :: Exception %s", v->err );
+    case LVAL_BIG:  {
+      char *s = lbig_str(v);
+      printf( "%s", s );
+      free(s);
+    }
+    break;
+    case LVAL_ERR:  {
+      char buf[512];
+      lval_err_format(v, buf, sizeof(buf));
+      printf( "  🚩 :: Exception %s", buf );
+    }
     break;
     case LVAL_SYM:
-      printf( "%s", v->sym );
+      printf( "%s", lval_sym_name(v) );
+    break;
+    case LVAL_REF:
+      printf( "%s", lval_sym_name(v->var) );
     break;
     case LVAL_FUN:
-      if ( !v->builtin )  {
+      if ( !lval_is_builtin(v) )  {
         printf("(\\ ");
-        lval_print(v->formals);
-        putchar(' ');
-        lval_print(v->body);
-        putchar(')');
+        lprint_push(NULL, ')');
+        lprint_push(v->body, 0);
+        lprint_push(NULL, ' ');
+        lprint_push(v->formals, 0);
       } else {
         printf( "<builtin>" );
       }
@@ -79,6 +167,20 @@ void lval_print( lval *v )  {
   }
 }
 
+void lval_print( lval *v )  {
+  int base = lprint_count;
+  lprint_push(v, 0);
+
+  while ( lprint_count > base )  {
+    lprint x = lprint_todo[--lprint_count];
+    if ( x.v )  {
+      lval_print_one(x.v);
+    } else {
+      putchar(x.c);
+    }
+  }
+}
+
 void lval_println( lval *v ) {
   lval_print( v );
   putchar('\n');
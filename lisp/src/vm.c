@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include "include.h"
+
+// lambda bodies are compiled the first time they are called, to a flat
+// list of instructions for a small stack machine, so a call no longer
+// copies its body and walks it cell by cell.
+//
+// a body is evaluated like any s expression: every cell is evaluated in
+// order, then the results are applied. the compiled form does the same
+// with one instruction per cell and a CALL for every s expression, which
+// applies the values it collected. q expressions are data and stay
+// constants, whatever eval later does with them is up to eval.
+// the body's own application is a tail call, so RET does not make it,
+// it hands the values back to be applied once the frame is left
+//
+// the code runs in lcode_eval below, which evaluates every s expression,
+// compiled or not, without recursing on the C stack
+//
+// the operands are the body's own cells, borrowed: every function that
+// shares the code also holds on to the body, which nobody mutates once
+// it is shared. lval_resolve has made every symbol in it a reference,
+// so a variable is always a REF.
+
+enum { LOP_CONST, LOP_REF, LOP_CALL, LOP_RET };
+
+// an instruction is an opcode in the low byte and an operand above it,
+// an index into vals for CONST and REF, a count of values for CALL and
+// RET
+#define LOP(op, arg)  ( (uint32_t)(op) | (uint32_t)(arg) << 8 )
+
+struct lcode {
+  int rc;
+  int count;
+  int cap;
+  lval **vals;
+  int nvals;
+  uint32_t *ops;
+};
+
+static void lcode_emit( lcode *c, uint32_t op )  {
+  if ( c->count == c->cap )  {
+    c->cap = c->cap ? c->cap * 2 : 16;
+    c->ops = realloc(c->ops, sizeof(uint32_t) * c->cap);
+  }
+  c->ops[c->count++] = op;
+}
+
+static int lcode_val( lcode *c, lval *v )  {
+  // grows at every power of two
+  if ( !(c->nvals & (c->nvals - 1)) )  {
+    c->vals = realloc(c->vals, sizeof(lval*) * (c->nvals ? c->nvals * 2 : 1));
+  }
+  c->vals[c->nvals] = v;
+  return c->nvals++;
+}
+
+// code leaving the value of a cell that is not an s expression
+static void lcode_leaf( lcode *c, lval *v )  {
+  int op = lval_type(v) == LVAL_REF ? LOP_REF : LOP_CONST;
+  lcode_emit(c, LOP(op, lcode_val(c, v)));
+}
+
+// an s expression part way through being compiled, cells before i done
+typedef struct {
+  lval *v;
+  size_t i;
+} lcode_todo;
+
+// body is the q expression of a lambda, run as an s expression. every
+// s expression in it is its cells then a CALL, the body's own is its
+// cells then the RET. nested ones wait on a stack of their own, not the
+// C stack
+lcode *lcode_compile( lval *body )  {
+  lcode *c = calloc(1, sizeof(lcode));
+  c->rc = 1;
+
+  int count = 1;
+  int cap = 16;
+  lcode_todo *todo = malloc(sizeof(lcode_todo) * cap);
+  todo[0] = (lcode_todo){ body, 0 };
+
+  while ( count )  {
+    lcode_todo *t = &todo[count - 1];
+
+    if ( t->i == t->v->count )  {
+      lcode_emit(c, LOP(count == 1 ? LOP_RET : LOP_CALL, t->v->count));
+      count--;
+      continue;
+    }
+
+    lval *x = t->v->cell[t->i++];
+    if ( lval_type(x) != LVAL_SEXPR )  {
+      lcode_leaf(c, x);
+      continue;
+    }
+
+    if ( count == cap )  {
+      cap *= 2;
+      todo = realloc(todo, sizeof(lcode_todo) * cap);
+    }
+    todo[count++] = (lcode_todo){ x, 0 };
+  }
+
+  free(todo);
+  return c;
+}
+
+lcode *lcode_copy( lcode *c )  {
+  if ( c )  { c->rc++; }
+  return c;
+}
+
+void lcode_del( lcode *c )  {
+  if ( !c || --c->rc > 0 )  { return; }
+  free(c->vals);
+  free(c->ops);
+  free(c);
+}
+
+// a piece of evaluation in progress. either an s expression having its
+// cells evaluated in place, one at a time, or the code of a lambda body
+// running on the value stack. both end in an application, which takes
+// the place of the work that led to it, so tail calls take no room
+typedef struct {
+  lval *expr;
+  size_t i;
+
+  lval *fun;
+  uint32_t *pc;
+
+  lenv *env;
+  // the frame of the call this work is the body of, left once it is done
+  lenv *frame;
+  int slots;
+} lwork;
+
+#define LCODE_LIMIT_DEFAULT  ( 1 << 20 )
+
+// work and values live on stacks of their own, not the C stack, so deep
+// recursion and deeply nested expressions run out of limit, not stack.
+// a builtin that evaluates something runs the machine again on top of
+// the same stacks, so pointers into them never outlive a builtin call
+static lwork *lcode_work = NULL;
+static int lcode_top = 0;
+static int lcode_cap = 0;
+static long lcode_limit = LCODE_LIMIT_DEFAULT;
+
+static lval **lcode_vals = NULL;
+static int lcode_sp = 0;
+static int lcode_vcap = 0;
+
+void lcode_tune( long limit )  {
+  lcode_limit = limit;
+}
+
+static void lcode_push_val( lval *v )  {
+  if ( lcode_sp == lcode_vcap )  {
+    lcode_vcap = lcode_vcap ? lcode_vcap * 2 : 256;
+    lcode_vals = realloc(lcode_vals, sizeof(lval*) * lcode_vcap);
+  }
+  lcode_vals[lcode_sp++] = v;
+}
+
+// the top n values as an s expression
+static lval *lcode_pop_vals( int n )  {
+  lcode_sp -= n;
+  lval *v = lval_sexpr();
+  for ( int i = 0; i < n; i++ )  { v = lval_add(v, lcode_vals[lcode_sp + i]); }
+  return v;
+}
+
+// new work on top, evaluating in e. NULL when the limit is reached
+static lwork *lcode_push( lenv *e )  {
+  if ( lcode_top >= lcode_limit )  { return NULL; }
+
+  if ( lcode_top == lcode_cap )  {
+    lcode_cap = lcode_cap ? lcode_cap * 2 : 64;
+    lcode_work = realloc(lcode_work, sizeof(lwork) * lcode_cap);
+  }
+
+  lgc_maybe();
+
+  lwork *w = &lcode_work[lcode_top++];
+  w->expr = NULL;
+  w->fun = NULL;
+  w->env = e;
+  w->frame = NULL;
+  return w;
+}
+
+// work evaluating the cells of v in e, v stays the caller's if there is
+// no room for it
+static lwork *lcode_push_expr( lenv *e, lval *v )  {
+  lwork *w = lcode_push(e);
+  if ( w )  {
+    w->expr = lval_own(v);
+    w->i = 0;
+  }
+  return w;
+}
+
+static lval *lcode_deep( void )  {
+  return lval_err("Evaluation nested deeper than %ld!", lcode_limit);
+}
+
+// apply v, values the top work has collected. what it leads to is more
+// work, which goes on top, or takes the place of the top work when v is
+// the last thing that does, its tail. NULL then, or the value v came to
+static lval *lcode_apply( lval *v, int tail )  {
+  lwork *w = &lcode_work[lcode_top - 1];
+
+  lval *result;
+  lval *f = lval_callee(v, &result);
+  if ( !f )  { return result; }
+
+  lbuiltin builtin = lval_to_builtin(f);
+
+  if ( builtin == builtin_eval && v->count == 1
+    && lval_type(v->cell[0]) == LVAL_QEXPR )  {
+    lval *x = lval_unquote(lval_take(v, 0));
+
+    // the quoted expression is evaluated as the rest of this work
+    if ( tail )  {
+      if ( w->fun )  { lval_del(w->fun); }
+      w->fun = NULL;
+      w->expr = x;
+      w->i = 0;
+      return NULL;
+    }
+
+    if ( lcode_push_expr(w->env, x) )  { return NULL; }
+    lval_del(x);
+    return lcode_deep();
+  }
+
+  if ( builtin )  { return builtin(w->env, v); }
+  if ( v->count != f->formals->count )  { return lval_partial(f, v); }
+
+  if ( tail )  {
+    // a call is the last thing its caller does, so the caller's frame
+    // is given back before this one takes its slots
+    if ( w->frame )  { lenv_leave(w->frame, w->slots); }
+    if ( w->fun )  { lval_del(w->fun); }
+  } else if ( !(w = lcode_push(NULL)) )  {
+    lval_del(f);
+    lval_del(v);
+    return lcode_deep();
+  }
+
+  // the frame takes the arguments over, v lets go of its own
+  for ( size_t i = 0; i < v->count; i++ )  { lval_copy(v->cell[i]); }
+  w->slots = v->count;
+  w->env = w->frame = lval_bind(f, v->cell, v->count);
+  w->fun = f;
+  w->pc = f->code->ops;
+  lval_del(v);
+  return NULL;
+}
+
+// apply the top n values on the value stack, like lcode_apply. a lambda
+// given all of its arguments binds them straight from the stack, without
+// an s expression to carry them. anything else, builtins, partial
+// applications and errors, goes through lcode_apply
+static lval *lcode_apply_vals( int n, int tail )  {
+  // () compiles to a CALL of no values, there is no function to look at
+  if ( n < 2 )  { return lcode_apply(lcode_pop_vals(n), tail); }
+
+  lval **a = &lcode_vals[lcode_sp - n];
+  lval *f = a[0];
+
+  int call = lval_type(f) == LVAL_FUN && !lval_is_builtin(f)
+    && n - 1 == f->formals->count;
+  for ( int i = 1; call && i < n; i++ )  {
+    if ( lval_type(a[i]) == LVAL_ERR )  { call = 0; }
+  }
+  if ( !call )  { return lcode_apply(lcode_pop_vals(n), tail); }
+
+  lcode_sp -= n;
+  lwork *w = &lcode_work[lcode_top - 1];
+
+  if ( tail )  {
+    if ( w->frame )  { lenv_leave(w->frame, w->slots); }
+    if ( w->fun )  { lval_del(w->fun); }
+  } else if ( !(w = lcode_push(NULL)) )  {
+    for ( int i = 0; i < n; i++ )  { lval_del(a[i]); }
+    return lcode_deep();
+  }
+
+  w->slots = n - 1;
+  w->env = w->frame = lval_bind(f, a + 1, n - 1);
+  w->fun = f;
+  w->pc = f->code->ops;
+  return NULL;
+}
+
+// the s expression v evaluated in e. everything it leads to, nested
+// expressions, calls and what eval makes of a q expression, runs here
+// in one loop
+lval *lcode_eval( lenv *e, lval *v )  {
+  int base = lcode_top;
+  if ( !lcode_push_expr(e, v) )  {
+    lval_del(v);
+    return lcode_deep();
+  }
+
+  for ( ;; )  {
+    lwork *w = &lcode_work[lcode_top - 1];
+
+    if ( w->expr && w->i < w->expr->count )  {
+      lval *x = w->expr->cell[w->i];
+
+      // looking a symbol up can load a module, which runs the machine
+      if ( lval_type(x) != LVAL_SEXPR )  {
+        x = lval_eval(w->env, x);
+        w = &lcode_work[lcode_top - 1];
+        w->expr->cell[w->i++] = x;
+        continue;
+      }
+
+      // the cell is taken out while it is evaluated, so the collector
+      // never sees it twice
+      w->expr->cell[w->i] = lval_int(0);
+      if ( !lcode_push_expr(w->env, x) )  {
+        lval_del(x);
+        w->expr->cell[w->i++] = lcode_deep();
+      }
+      continue;
+    }
+
+    if ( w->fun )  {
+      lcode *c = w->fun->code;
+      uint32_t op = *w->pc++;
+      uint32_t arg = op >> 8;
+      lval *x;
+
+      switch ( op & 0xFF )  {
+        case LOP_CONST:
+          lcode_push_val(lval_copy(c->vals[arg]));
+        continue;
+        case LOP_REF:
+          lcode_push_val(lenv_ref(w->env, c->vals[arg]));
+        continue;
+        case LOP_CALL:
+          x = lcode_apply_vals(arg, 0);
+          if ( x )  { lcode_push_val(x); }
+        continue;
+      }
+    }
+
+    // the work is done and applies either the cells it evaluated or the
+    // values of the body's last call
+    lval *result;
+    if ( w->expr )  {
+      v = w->expr;
+      w->expr = NULL;
+      result = lcode_apply(v, 1);
+    } else {
+      result = lcode_apply_vals(w->pc[-1] >> 8, 1);
+    }
+    if ( !result )  { continue; }
+
+    w = &lcode_work[lcode_top - 1];
+    if ( w->frame )  { lenv_leave(w->frame, w->slots); }
+    if ( w->fun )  { lval_del(w->fun); }
+    lcode_top--;
+
+    if ( lcode_top == base )  { return result; }
+
+    w = &lcode_work[lcode_top - 1];
+    if ( w->expr )  {
+      w->expr->cell[w->i++] = result;
+    } else {
+      lcode_push_val(result);
+    }
+  }
+}